@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Builds the Linux app and checks every graph configuration against the golden
+# files in this folder. Any extra arguments are passed on to --golden-check,
+# e.g. --config oversampled-x4, --max-ulps 2 or --record-timings. With --record
+# as the first argument it records the goldens and timings instead.
+#
+# The app is built with floating point contraction off. The Linux makefile
+# builds with -march=native, and on a CPU with FMA the compiler would otherwise
+# fuse the filters' multiplies and adds, which changes the output by many ULPs.
+# Object files built with other flags are cleaned first, so that no stale
+# object is linked in.
+
+set -e
+
+mode="--golden-check"
+
+if [ "$1" = "--record" ]; then
+    mode="--golden-record"
+    shift
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+build="$here/../Builds/LinuxMakefile"
+flags="-ffp-contract=off"
+stamp="$build/build/intermediate/Release/golden-check-flags"
+
+if [ "$(cat "$stamp" 2>/dev/null)" != "$flags" ]; then
+    make -C "$build" CONFIG=Release clean
+fi
+
+make -C "$build" CONFIG=Release CXXFLAGS="$flags" -j"$(nproc 2>/dev/null || echo 2)"
+mkdir -p "$(dirname "$stamp")"
+echo "$flags" > "$stamp"
+
+# the harness doesn't open a window, but JUCE still wants an X display on Linux
+run=""
+
+if [ -z "$DISPLAY" ] && command -v xvfb-run > /dev/null; then
+    run="xvfb-run -a"
+fi
+
+exec $run "$build/build/ProcessingAudioInputTutorial" "$mode" "$here" "$@"
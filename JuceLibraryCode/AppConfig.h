@@ -18,6 +18,11 @@
 
 // (You can add your own code in this section, and the Projucer will not overwrite it)
 
+// Set to 1 to record trace events (see TraceCapture.h); Cmd/Ctrl+T writes them out
+#ifndef ENABLE_TRACE_CAPTURE
+ #define ENABLE_TRACE_CAPTURE 0
+#endif
+
 // [END_USER_CODE_SECTION]
 
 /*
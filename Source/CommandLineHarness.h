@@ -0,0 +1,70 @@
+/*
+  ==============================================================================
+
+    CommandLineHarness.h
+
+    Shared scaffolding for the test and benchmark harnesses that run from the
+    command line instead of opening the window; Main.cpp picks the harness
+    from the arguments. No audio device or window is opened while one runs.
+
+    Each harness logs its lines with its own prefix, and its exit code is 0
+    if every check passed, or 1 after logging the first check that failed.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class CommandLineHarness
+{
+public:
+    // True if the command line has any of the arguments that select Harness
+    template <typename Harness>
+    static bool isRequested(const StringArray& args)
+    {
+        for (auto& argument : Harness::getArguments())
+            if (args.contains(argument))
+                return true;
+
+        return false;
+    }
+
+    // The argument following name, or defaultValue if name isn't there
+    static String getArgumentValue(const StringArray& args, const String& name, const String& defaultValue = {})
+    {
+        const int index = args.indexOf(name);
+        return index >= 0 && index + 1 < args.size() ? args[index + 1] : defaultValue;
+    }
+
+protected:
+    // logPrefix starts every line the harness logs, e.g. "cpu-stress"
+    explicit CommandLineHarness(const String& logPrefix)
+        : prefix(logPrefix)
+    {
+    }
+
+    void log(const String& message) const
+    {
+        Logger::writeToLog(prefix + ": " + message);
+    }
+
+    // Logs the end of a run where every check passed and returns its exit code
+    int pass(const String& message = "pass") const
+    {
+        log(message);
+        return 0;
+    }
+
+    // Logs the check that failed and returns the exit code for a failed run
+    int fail(const String& message) const
+    {
+        log("FAIL " + message);
+        return 1;
+    }
+
+private:
+    const String prefix;
+
+    JUCE_DECLARE_NON_COPYABLE (CommandLineHarness)
+};
@@ -0,0 +1,561 @@
+/*
+  ==============================================================================
+
+    CpuBudget.h
+
+    Per-node CPU accounting and graceful degradation for the AudioProcessorGraph.
+
+    Every node that should be accounted for is added to the graph wrapped in a
+    BudgetedNodeProcessor, which times its processBlock with the high resolution
+    tick counter. After each graph callback the CpuBudgetMonitor compares the
+    whole graph's time against the buffer deadline and each node's time against
+    its own budget, and steps low-priority nodes down to cheaper quality levels
+    (or bypass) when needed. Every change is crossfaded, so degrading or
+    restoring a node never produces a discontinuity. The dry signal is delayed
+    by the node's latency, so it stays aligned with the wet signal.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class CpuBudgetMonitor;
+
+//==============================================================================
+// Implemented by processors that can trade quality for CPU.
+// Level 0 is full quality; higher levels are progressively cheaper.
+class QualityScalable
+{
+public:
+    virtual ~QualityScalable() {}
+
+    // The number of quality levels this processor supports (at least 1)
+    virtual int getNumQualityLevels() const = 0;
+
+    // Switch to the given quality level; only ever called from the audio thread
+    // between blocks. Unless switchesQualitySmoothly() is true, the node's output
+    // is crossfaded fully to dry first and back afterwards, so the effect dips
+    // out for two fade lengths (about 20ms) around the switch.
+    virtual void setQualityLevel(int level) = 0;
+
+    // Return true if setQualityLevel() crossfades from the old level into the
+    // new one by itself (or the levels sound the same), so the node can switch
+    // while staying fully wet
+    virtual bool switchesQualitySmoothly() const    { return false; }
+};
+
+//==============================================================================
+// Wraps a processor so its CPU use is measured and it can be degraded on demand.
+// The degradation level runs from 0 (full quality) through the inner processor's
+// quality levels up to getBypassLevel(), at which point the node passes its
+// input straight through.
+class BudgetedNodeProcessor   : public AudioProcessor
+{
+public:
+    // Takes ownership of the inner processor.
+    // budgetFraction is the share of the buffer deadline this node may use;
+    // nodes with lower priority are degraded first.
+    BudgetedNodeProcessor(AudioProcessor* innerProcessor, CpuBudgetMonitor& budgetMonitor,
+                          int nodePriority, double budgetFraction);
+
+    ~BudgetedNodeProcessor();
+
+    //==============================================================================
+    const String getName() const override   { return inner->getName(); }
+
+    void prepareToPlay(double sampleRate, int maximumExpectedSamplesPerBlock) override
+    {
+        inner->setPlayConfigDetails(getTotalNumInputChannels(), getTotalNumOutputChannels(),
+                                    sampleRate, maximumExpectedSamplesPerBlock);
+        inner->setProcessingPrecision(getProcessingPrecision());
+        inner->prepareToPlay(sampleRate, maximumExpectedSamplesPerBlock);
+        setLatencySamples(inner->getLatencySamples());
+
+        dryBuffer.setSize(jmax(getTotalNumInputChannels(), getTotalNumOutputChannels()),
+                          maximumExpectedSamplesPerBlock);
+
+        dryDelaySamples = getLatencySamples();
+        dryDelayLine.setSize(getTotalNumInputChannels(), dryDelaySamples + maximumExpectedSamplesPerBlock);
+        dryDelayLine.clear();
+
+        // a full crossfade takes about 10ms, but never less than one block
+        fadeLengthSamples = jmax(maximumExpectedSamplesPerBlock, roundToInt(sampleRate * 0.01));
+    }
+
+    void releaseResources() override
+    {
+        inner->releaseResources();
+        dryBuffer.setSize(0, 0);
+        dryDelayLine.setSize(0, 0);
+    }
+
+    void reset() override
+    {
+        inner->reset();
+        dryDelayLine.clear();
+    }
+
+    void setNonRealtime(bool isNonRealtime) noexcept override
+    {
+        AudioProcessor::setNonRealtime(isNonRealtime);
+        inner->setNonRealtime(isNonRealtime);
+    }
+
+    void processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override;
+
+    double getTailLengthSeconds() const override    { return inner->getTailLengthSeconds(); }
+    bool acceptsMidi() const override               { return inner->acceptsMidi(); }
+    bool producesMidi() const override              { return inner->producesMidi(); }
+
+    AudioProcessorEditor* createEditor() override   { return nullptr; }
+    bool hasEditor() const override                 { return false; }
+
+    int getNumPrograms() override                           { return inner->getNumPrograms(); }
+    int getCurrentProgram() override                        { return inner->getCurrentProgram(); }
+    void setCurrentProgram(int index) override              { inner->setCurrentProgram(index); }
+    const String getProgramName(int index) override         { return inner->getProgramName(index); }
+    void changeProgramName(int index, const String& name) override  { inner->changeProgramName(index, name); }
+
+    void getStateInformation(MemoryBlock& destData) override        { inner->getStateInformation(destData); }
+    void setStateInformation(const void* data, int size) override   { inner->setStateInformation(data, size); }
+
+    //==============================================================================
+    AudioProcessor* getInnerProcessor() const   { return inner.get(); }
+    int getPriority() const                     { return priority; }
+    double getBudgetFraction() const            { return budgetFraction; }
+
+    // The level at which the node is bypassed entirely
+    int getBypassLevel() const                  { return scalable != nullptr ? scalable->getNumQualityLevels() : 1; }
+
+    // The level the node is currently running at (or fading towards)
+    int getAppliedLevel() const                 { return appliedLevel; }
+
+    // Ask for a new degradation level; takes effect after a crossfade
+    void requestLevel(int level)                { requestedLevel = jlimit(0, getBypassLevel(), level); }
+    int getRequestedLevel() const               { return requestedLevel; }
+
+    // True while the node is crossfading between levels
+    bool isTransitioning() const                { return appliedLevel != requestedLevel || (wetGain > 0.0f && wetGain < 1.0f) || warmUpSamples > 0; }
+
+    // The ticks spent in the most recent processBlock
+    int64 getLastBlockTicks() const             { return lastBlockTicks; }
+
+    // The most recent block's CPU time as a fraction of the buffer deadline (readable from any thread)
+    float getLoad() const                       { return load.load(); }
+
+private:
+    friend class CpuBudgetMonitor;
+
+    std::unique_ptr<AudioProcessor> inner;
+    QualityScalable* scalable;
+    CpuBudgetMonitor& monitor;
+
+    const int priority;
+    const double budgetFraction;
+
+   #if ENABLE_TRACE_CAPTURE
+    const char* const traceName;
+   #endif
+
+    AudioBuffer<float> dryBuffer;
+    AudioBuffer<float> dryDelayLine;
+    int dryDelaySamples = 0;
+    int fadeLengthSamples = 512;
+    float wetGain = 1.0f;
+    int warmUpSamples = 0;
+
+    int appliedLevel = 0;
+    int requestedLevel = 0;
+
+    int64 lastBlockTicks = 0;
+    int consecutiveOverruns = 0;
+    std::atomic<float> load { 0.0f };
+
+    // The smoothed load measured while running steadily at each level, or -1 if
+    // the node hasn't run at that level yet; only used by the monitor
+    Array<float> levelLoads;
+
+    void captureDry(const AudioBuffer<float>& buffer, int numSamples);
+
+    static BusesProperties getBusesPropertiesFor(const AudioProcessor& processor)
+    {
+        BusesProperties buses;
+
+        if (processor.getTotalNumInputChannels() > 0)
+            buses = buses.withInput("Input", AudioChannelSet::discreteChannels(processor.getTotalNumInputChannels()), true);
+
+        if (processor.getTotalNumOutputChannels() > 0)
+            buses = buses.withOutput("Output", AudioChannelSet::discreteChannels(processor.getTotalNumOutputChannels()), true);
+
+        return buses;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BudgetedNodeProcessor)
+};
+
+//==============================================================================
+// Tracks CPU use across the graph and decides which nodes to degrade or restore.
+// Nodes register themselves on construction; all the decisions are made on the
+// audio thread in endBlock(), so no node state is shared with other threads
+// apart from the atomic load figures.
+class CpuBudgetMonitor
+{
+public:
+    // callbackLock must be the lock held around the graph's processBlock,
+    // so nodes can be added and removed safely while audio is running
+    CpuBudgetMonitor(const CriticalSection& graphCallbackLock)
+        : callbackLock(graphCallbackLock)
+    {
+    }
+
+    // Degrade when the graph uses more than this fraction of the deadline
+    void setDegradeThreshold(double fraction)       { degradeThreshold = fraction; }
+
+    // Restore once the graph has used less than this fraction for restoreDelayBlocks blocks,
+    // and only if the graph is expected to stay under it with the node back at its next
+    // level up, going by what the node was measured to cost there before
+    void setRestoreThreshold(double fraction)       { restoreThreshold = fraction; }
+    void setRestoreDelayBlocks(int numBlocks)       { restoreDelayBlocks = numBlocks; }
+
+    // A node which runs over its own budget for this many consecutive blocks is
+    // degraded even when the graph as a whole is within its deadline
+    void setOverrunsBeforeDegrade(int numBlocks)    { overrunsBeforeDegrade = numBlocks; }
+
+    // The most recent block's total graph CPU time as a fraction of the deadline
+    float getGraphLoad() const                      { return graphLoad.load(); }
+
+    // The number of blocks which have run past their deadline
+    int getNumDeadlineMisses() const                { return deadlineMisses.load(); }
+
+    // Called before the graph is prepared; the audio thread may still be running
+    void prepare(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+    }
+
+    void addNode(BudgetedNodeProcessor* node)
+    {
+        const ScopedLock sl(callbackLock);
+        nodes.addIfNotAlreadyThere(node);
+    }
+
+    void removeNode(BudgetedNodeProcessor* node)
+    {
+        const ScopedLock sl(callbackLock);
+        nodes.removeFirstMatchingValue(node);
+    }
+
+    // Called on the audio thread after each graph callback
+    void endBlock(int64 graphTicks, int numSamples)
+    {
+        const double currentSampleRate = sampleRate.load();
+
+        if (currentSampleRate <= 0.0 || numSamples <= 0)
+            return;
+
+        const double deadlineTicks = numSamples * (double) Time::getHighResolutionTicksPerSecond() / currentSampleRate;
+        const double load = graphTicks / deadlineTicks;
+
+        graphLoad = (float) load;
+
+        if (load >= 1.0)
+            ++deadlineMisses;
+
+        BudgetedNodeProcessor* overrunNode = nullptr;
+
+        for (auto* node : nodes)
+        {
+            const double nodeLoad = node->lastBlockTicks / deadlineTicks;
+            node->load = (float) nodeLoad;
+
+            if (! node->isTransitioning())
+            {
+                float& levelLoad = node->levelLoads.getReference(node->appliedLevel);
+                levelLoad = levelLoad < 0.0f ? (float) nodeLoad : levelLoad + 0.05f * ((float) nodeLoad - levelLoad);
+            }
+
+            if (nodeLoad > node->budgetFraction)
+                ++node->consecutiveOverruns;
+            else
+                node->consecutiveOverruns = 0;
+
+            if (node->consecutiveOverruns >= overrunsBeforeDegrade && canDegrade(node)
+                 && (overrunNode == nullptr || node->priority < overrunNode->priority))
+                overrunNode = node;
+        }
+
+        // only one node changes level per block, so the effect of each change can be measured
+        if (overrunNode != nullptr)
+        {
+            degrade(overrunNode);
+        }
+        else if (load > degradeThreshold)
+        {
+            if (auto* node = findNodeToDegrade())
+                degrade(node);
+        }
+        else if (load < restoreThreshold)
+        {
+            if (++quietBlocks >= restoreDelayBlocks)
+            {
+                if (auto* node = findNodeToRestore(load))
+                    node->requestLevel(node->requestedLevel - 1);
+
+                quietBlocks = 0;
+            }
+
+            return;
+        }
+
+        quietBlocks = 0;
+    }
+
+private:
+    const CriticalSection& callbackLock;
+    Array<BudgetedNodeProcessor*> nodes;
+
+    std::atomic<double> sampleRate { 0.0 };
+    double degradeThreshold = 0.7;
+    double restoreThreshold = 0.4;
+    int restoreDelayBlocks = 200;
+    int overrunsBeforeDegrade = 8;
+    int quietBlocks = 0;
+
+    std::atomic<float> graphLoad { 0.0f };
+    std::atomic<int> deadlineMisses { 0 };
+
+    static bool canDegrade(const BudgetedNodeProcessor* node)
+    {
+        return ! node->isTransitioning() && node->requestedLevel < node->getBypassLevel();
+    }
+
+    void degrade(BudgetedNodeProcessor* node)
+    {
+        node->requestLevel(node->requestedLevel + 1);
+        node->consecutiveOverruns = 0;
+        quietBlocks = 0;
+    }
+
+    // The lowest-priority node that still has a cheaper level to go to;
+    // among equal priorities, the one using the most CPU
+    BudgetedNodeProcessor* findNodeToDegrade() const
+    {
+        BudgetedNodeProcessor* result = nullptr;
+
+        for (auto* node : nodes)
+            if (canDegrade(node)
+                 && (result == nullptr
+                      || node->priority < result->priority
+                      || (node->priority == result->priority && node->lastBlockTicks > result->lastBlockTicks)))
+                result = node;
+
+        return result;
+    }
+
+    // The highest-priority degraded node that would keep the graph under the restore
+    // threshold at its next level up. A level the node hasn't been measured at is
+    // assumed to fit, so that it gets measured.
+    BudgetedNodeProcessor* findNodeToRestore(double load) const
+    {
+        BudgetedNodeProcessor* result = nullptr;
+
+        for (auto* node : nodes)
+        {
+            if (node->isTransitioning() || node->requestedLevel == 0
+                 || (result != nullptr && node->priority <= result->priority))
+                continue;
+
+            const float currentLoad = node->levelLoads[node->requestedLevel];
+            const float restoredLoad = node->levelLoads[node->requestedLevel - 1];
+
+            if (restoredLoad < 0.0f || load - jmax(0.0f, currentLoad) + restoredLoad < restoreThreshold)
+                result = node;
+        }
+
+        return result;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CpuBudgetMonitor)
+};
+
+//==============================================================================
+inline BudgetedNodeProcessor::BudgetedNodeProcessor(AudioProcessor* innerProcessor, CpuBudgetMonitor& budgetMonitor,
+                                                    int nodePriority, double nodeBudgetFraction)
+    : AudioProcessor(getBusesPropertiesFor(*innerProcessor)),
+      inner(innerProcessor),
+      scalable(dynamic_cast<QualityScalable*>(innerProcessor)),
+      monitor(budgetMonitor),
+      priority(nodePriority),
+      budgetFraction(nodeBudgetFraction)
+     #if ENABLE_TRACE_CAPTURE
+      , traceName(TRACE_INTERN(innerProcessor->getName()))
+     #endif
+{
+    levelLoads.insertMultiple(0, -1.0f, getBypassLevel() + 1);
+    monitor.addNode(this);
+}
+
+inline BudgetedNodeProcessor::~BudgetedNodeProcessor()
+{
+    monitor.removeNode(this);
+}
+
+inline void BudgetedNodeProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
+{
+    TRACE_SCOPE(traceName);
+
+    const int64 startTicks = Time::getHighResolutionTicks();
+    const int numSamples = buffer.getNumSamples();
+    const int bypassLevel = getBypassLevel();
+
+    if (appliedLevel != requestedLevel)
+    {
+        // a processor that switches quality smoothly changes level while fully wet;
+        // otherwise levels only change once the output has been faded all the way to dry
+        const bool switchWhileWet = scalable != nullptr && scalable->switchesQualitySmoothly()
+                                     && appliedLevel < bypassLevel && requestedLevel < bypassLevel;
+
+        if (switchWhileWet || wetGain == 0.0f)
+        {
+            // after a bypass the inner processor starts from silence, so it runs on the dry
+            // signal for its latency before its output is faded in
+            if (appliedLevel == bypassLevel)
+            {
+                inner->reset();
+                warmUpSamples = getLatencySamples();
+            }
+
+            appliedLevel = requestedLevel;
+
+            if (appliedLevel == bypassLevel)
+                warmUpSamples = 0;
+
+            if (scalable != nullptr && appliedLevel < bypassLevel)
+                scalable->setQualityLevel(appliedLevel);
+        }
+    }
+
+    const bool warmingUp = warmUpSamples > 0;
+    const bool wantWet = appliedLevel == requestedLevel && appliedLevel < bypassLevel && ! warmingUp;
+    const float step = numSamples / (float) fadeLengthSamples;
+    const float startGain = wetGain;
+    const float endGain = wantWet ? jmin(1.0f, startGain + step) : jmax(0.0f, startGain - step);
+    wetGain = endGain;
+
+    const bool fullyWet = startGain == 1.0f && endGain == 1.0f;
+    const int numChannels = jmin(buffer.getNumChannels(), dryBuffer.getNumChannels());
+
+    // the delay line has to see every block, even when its output isn't needed
+    if (! fullyWet || dryDelaySamples > 0)
+        captureDry(buffer, numSamples);
+
+    if (fullyWet)
+    {
+        inner->processBlock(buffer, midiMessages);
+    }
+    else if (startGain == 0.0f && endGain == 0.0f)
+    {
+        if (warmingUp)
+        {
+            inner->processBlock(buffer, midiMessages);
+            warmUpSamples = jmax(0, warmUpSamples - numSamples);
+        }
+
+        // bypassed or warming up: inputs pass through with the node's latency, any extra outputs are silent
+        for (int channel = 0; channel < numChannels; ++channel)
+            buffer.copyFrom(channel, 0, dryBuffer, channel, 0, numSamples);
+    }
+    else
+    {
+        inner->processBlock(buffer, midiMessages);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            buffer.applyGainRamp(channel, 0, numSamples, startGain, endGain);
+            buffer.addFromWithRamp(channel, 0, dryBuffer.getReadPointer(channel), numSamples,
+                                   1.0f - startGain, 1.0f - endGain);
+        }
+    }
+
+    lastBlockTicks = Time::getHighResolutionTicks() - startTicks;
+}
+
+// Fills dryBuffer with the input delayed by the node's latency, so the dry signal
+// lines up with the wet one and with the latency the graph compensates for
+inline void BudgetedNodeProcessor::captureDry(const AudioBuffer<float>& buffer, int numSamples)
+{
+    const int numChannels = jmin(buffer.getNumChannels(), dryBuffer.getNumChannels());
+
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        if (channel >= getTotalNumInputChannels())
+        {
+            dryBuffer.clear(channel, 0, numSamples);
+        }
+        else if (dryDelaySamples == 0)
+        {
+            dryBuffer.copyFrom(channel, 0, buffer, channel, 0, numSamples);
+        }
+        else
+        {
+            // the delay line holds dryDelaySamples of history, then this block
+            float* delayLine = dryDelayLine.getWritePointer(channel);
+
+            FloatVectorOperations::copy(delayLine + dryDelaySamples, buffer.getReadPointer(channel), numSamples);
+            dryBuffer.copyFrom(channel, 0, delayLine, numSamples);
+            std::memmove(delayLine, delayLine + numSamples, (size_t) dryDelaySamples * sizeof(float));
+        }
+    }
+}
+
+//==============================================================================
+// An AudioProcessorGraph which measures each callback and lets its
+// CpuBudgetMonitor degrade or restore budgeted nodes after every block.
+class BudgetedProcessorGraph   : public AudioProcessorGraph
+{
+public:
+    BudgetedProcessorGraph()
+        : budgetMonitor(getCallbackLock())
+    {
+    }
+
+    ~BudgetedProcessorGraph()
+    {
+        // budgeted nodes unregister from the monitor, so they must go before it does
+        clear();
+    }
+
+    // Add a processor wrapped in a BudgetedNodeProcessor; takes ownership of the processor
+    Node::Ptr addBudgetedNode(AudioProcessor* processor, int priority, double budgetFraction)
+    {
+        return addNode(new BudgetedNodeProcessor(processor, budgetMonitor, priority, budgetFraction));
+    }
+
+    CpuBudgetMonitor& getBudgetMonitor()    { return budgetMonitor; }
+
+    void prepareToPlay(double sampleRate, int estimatedSamplesPerBlock) override
+    {
+        budgetMonitor.prepare(sampleRate);
+        AudioProcessorGraph::prepareToPlay(sampleRate, estimatedSamplesPerBlock);
+    }
+
+    using AudioProcessorGraph::processBlock;
+
+    void processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override
+    {
+        TRACE_SCOPE("Graph");
+
+        const int64 startTicks = Time::getHighResolutionTicks();
+
+        AudioProcessorGraph::processBlock(buffer, midiMessages);
+
+        // offline renders have no deadline, and must not change with the machine's load
+        if (! isNonRealtime())
+            budgetMonitor.endBlock(Time::getHighResolutionTicks() - startTicks, buffer.getNumSamples());
+    }
+
+private:
+    CpuBudgetMonitor budgetMonitor;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BudgetedProcessorGraph)
+};
@@ -0,0 +1,357 @@
+/*
+  ==============================================================================
+
+    CpuStressTest.h
+
+    Stress test for the CPU budget. A chain of nodes that burn a configurable
+    amount of CPU runs in a realtime BudgetedProcessorGraph, and their load is
+    raised until the budget monitor has to degrade them. Each quality level
+    of a node has its own gain and polarity, different from the dry signal's,
+    so a switch that isn't crossfaded shows up as a step in the output. Half
+    the nodes crossfade between levels themselves and half leave it to the
+    budget, so both ways of switching are exercised. The test checks that the
+    output stayed continuous throughout and aligned with the input whenever
+    the chain was steady, and that only a bounded number of blocks ran past
+    their deadline.
+
+    Usage:
+
+        ProcessingAudioInputTutorial --cpu-stress [options]
+
+    options:
+        --seconds <n>               length of audio to render (default 20)
+        --block-size <n>            samples per processBlock call (default 64)
+        --max-deadline-misses <n>   allowed missed deadlines (default 1% of blocks)
+
+    The blocks are rendered back to back rather than paced by a device, so
+    the test takes roughly as long as the audio it renders.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+// Passes its input through a fixed delay and a gain while spinning for a set
+// fraction of each block's deadline. Every quality level halves the time spent
+// and has a different gain, so switching levels without a crossfade makes a
+// step in the output. A processor created with crossfadeLevels ramps its gain
+// from one level to the next itself; otherwise it switches at once.
+class SyntheticLoadProcessor   : public AudioProcessor,
+                                 public QualityScalable
+{
+public:
+    SyntheticLoadProcessor(int numChannels, int latencySamples, bool crossfadeLevels)
+        : AudioProcessor(BusesProperties()
+                            .withInput("Input", AudioChannelSet::discreteChannels(numChannels), true)
+                            .withOutput("Output", AudioChannelSet::discreteChannels(numChannels), true)),
+          delaySamples(latencySamples),
+          crossfadesLevels(crossfadeLevels)
+    {
+        setLatencySamples(delaySamples);
+    }
+
+    // The CPU to use per block at full quality, as a fraction of the block's deadline
+    void setLoad(float fractionOfDeadline)              { load = fractionOfDeadline; }
+
+    // The gain applied at a quality level: each level flips the polarity and is quieter
+    // than the last, and none of them matches the dry signal's gain of 1
+    static float getLevelGain(int level)                { return (level % 2 == 0 ? -1.0f : 1.0f) / (float) (level + 1); }
+
+    // True while the gain is still ramping towards the current level's
+    bool isRampingGain() const                          { return gain != getLevelGain(qualityLevel); }
+
+    //==============================================================================
+    int getNumQualityLevels() const override            { return 3; }
+    bool switchesQualitySmoothly() const override       { return crossfadesLevels; }
+
+    void setQualityLevel(int level) override
+    {
+        qualityLevel = level;
+
+        if (! crossfadesLevels)
+            gain = getLevelGain(level);
+    }
+
+    //==============================================================================
+    const String getName() const override               { return "Synthetic load"; }
+
+    void prepareToPlay(double newSampleRate, int maximumExpectedSamplesPerBlock) override
+    {
+        sampleRate = newSampleRate;
+        delayLine.setSize(getTotalNumInputChannels(), delaySamples + maximumExpectedSamplesPerBlock);
+        delayLine.clear();
+        setLatencySamples(delaySamples);
+
+        // a ramp between levels takes about 10ms
+        gainRampSamples = jmax(1, roundToInt(sampleRate * 0.01));
+    }
+
+    void releaseResources() override                    { delayLine.setSize(0, 0); }
+
+    void processBlock(AudioBuffer<float>& buffer, MidiBuffer&) override
+    {
+        const int64 startTicks = Time::getHighResolutionTicks();
+        const int numSamples = buffer.getNumSamples();
+
+        for (int channel = 0; channel < getTotalNumInputChannels(); ++channel)
+        {
+            float* delayed = delayLine.getWritePointer(channel);
+
+            FloatVectorOperations::copy(delayed + delaySamples, buffer.getReadPointer(channel), numSamples);
+            buffer.copyFrom(channel, 0, delayed, numSamples);
+            std::memmove(delayed, delayed + numSamples, sizeof(float) * (size_t) delaySamples);
+        }
+
+        const float targetGain = getLevelGain(qualityLevel);
+        const float maxChange = 2.0f * numSamples / (float) gainRampSamples;
+        const float startGain = gain;
+        gain = jlimit(startGain - maxChange, startGain + maxChange, targetGain);
+
+        for (int channel = 0; channel < getTotalNumOutputChannels(); ++channel)
+            buffer.applyGainRamp(channel, 0, numSamples, startGain, gain);
+
+        const double deadlineTicks = numSamples * (double) Time::getHighResolutionTicksPerSecond() / sampleRate;
+        const int64 endTicks = startTicks + (int64) (deadlineTicks * load.load() / (1 << qualityLevel));
+
+        while (Time::getHighResolutionTicks() < endTicks)
+        {
+        }
+    }
+
+    void reset() override                               { delayLine.clear(); }
+
+    double getTailLengthSeconds() const override        { return 0.0; }
+    bool acceptsMidi() const override                   { return false; }
+    bool producesMidi() const override                  { return false; }
+
+    AudioProcessorEditor* createEditor() override       { return nullptr; }
+    bool hasEditor() const override                     { return false; }
+
+    int getNumPrograms() override                       { return 1; }
+    int getCurrentProgram() override                    { return 0; }
+    void setCurrentProgram(int) override                {}
+    const String getProgramName(int) override           { return {}; }
+    void changeProgramName(int, const String&) override {}
+
+    void getStateInformation(MemoryBlock&) override     {}
+    void setStateInformation(const void*, int) override {}
+
+private:
+    const int delaySamples;
+    const bool crossfadesLevels;
+    AudioBuffer<float> delayLine;
+    double sampleRate = 44100.0;
+    int gainRampSamples = 441;
+
+    std::atomic<float> load { 0.0f };
+    int qualityLevel = 0;
+    float gain = getLevelGain(0);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SyntheticLoadProcessor)
+};
+
+//==============================================================================
+class CpuStressTest   : public CommandLineHarness
+{
+public:
+    static StringArray getArguments()   { return { "--cpu-stress" }; }
+
+    // Run the stress test and return the process exit code
+    static int run(const StringArray& args)
+    {
+        CpuStressTest test;
+        test.seconds = jmax(1.0, getArgumentValue(args, "--seconds", "20").getDoubleValue());
+        test.blockSize = jmax(1, getArgumentValue(args, "--block-size", "64").getIntValue());
+        test.maxDeadlineMisses = getArgumentValue(args, "--max-deadline-misses", "-1").getIntValue();
+
+        return test.runTest();
+    }
+
+private:
+    static constexpr int numChannels = 2;
+    static constexpr int numNodes = 4;
+    static constexpr int nodeLatencySamples = 32;
+
+    // each node's load ramps up to this over the first three quarters of the run,
+    // so at full quality the chain would need 1.8 times the deadline
+    static constexpr float peakNodeLoad = 0.45f;
+
+    double sampleRate = 48000.0;
+    double seconds = 20.0;
+    int blockSize = 64;
+    int maxDeadlineMisses = -1;
+
+    CpuStressTest()
+        : CommandLineHarness("cpu-stress")
+    {
+    }
+
+    // The test signal: a different sine on each channel
+    float getInputSample(int channel, int64 position) const
+    {
+        if (position < 0)
+            return 0.0f;
+
+        const double frequency = 440.0 * (channel + 1);
+        return (float) (0.5 * std::sin(MathConstants<double>::twoPi * frequency * position / sampleRate));
+    }
+
+    // The largest sample-to-sample step in the test signal
+    float getMaximumInputStep() const
+    {
+        return (float) (0.5 * MathConstants<double>::twoPi * 440.0 * numChannels / sampleRate);
+    }
+
+    int runTest()
+    {
+        BudgetedProcessorGraph graph;
+        graph.setPlayConfigDetails(numChannels, numChannels, sampleRate, blockSize);
+        graph.setProcessingPrecision(AudioProcessor::singlePrecision);
+
+        AudioProcessorGraph::Node::Ptr inputNodePtr = graph.addNode(new AudioProcessorGraph::AudioGraphIOProcessor(
+            AudioProcessorGraph::AudioGraphIOProcessor::audioInputNode));
+        AudioProcessorGraph::Node::Ptr outputNodePtr = graph.addNode(new AudioProcessorGraph::AudioGraphIOProcessor(
+            AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode));
+
+        Array<SyntheticLoadProcessor*> loads;
+        Array<BudgetedNodeProcessor*> budgetedNodes;
+        AudioProcessorGraph::Node::Ptr previousNodePtr = inputNodePtr;
+
+        // node 0 has the lowest priority, so it's degraded first; the even nodes
+        // crossfade between levels themselves and the odd ones don't
+        for (int i = 0; i < numNodes; ++i)
+        {
+            SyntheticLoadProcessor* load = new SyntheticLoadProcessor(numChannels, nodeLatencySamples, i % 2 == 0);
+            AudioProcessorGraph::Node::Ptr nodePtr = graph.addBudgetedNode(load, i, 0.4);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                graph.addConnection({ { previousNodePtr->nodeID, channel }, { nodePtr->nodeID, channel } });
+
+            loads.add(load);
+            budgetedNodes.add(dynamic_cast<BudgetedNodeProcessor*>(nodePtr->getProcessor()));
+            previousNodePtr = nodePtr;
+        }
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            graph.addConnection({ { previousNodePtr->nodeID, channel }, { outputNodePtr->nodeID, channel } });
+
+        graph.prepareToPlay(sampleRate, blockSize);
+
+        const int numBlocks = roundToInt(seconds * sampleRate / blockSize);
+        const int rampBlocks = numBlocks * 3 / 4;
+        const int64 totalLatency = numNodes * nodeLatencySamples;
+        const int allowedDeadlineMisses = maxDeadlineMisses >= 0 ? maxDeadlineMisses : numBlocks / 100;
+
+        AudioBuffer<float> block(numChannels, blockSize);
+        MidiBuffer midi;
+        float previousOutput[numChannels] = {};
+        float maxStep = 0.0f;
+        float maxAlignmentError = 0.0f;
+        int maxLevel = 0;
+        int64 steadySamples = 0;
+        int64 checkedSamples = 0;
+
+        // the quality level switches seen on nodes that crossfade them and on nodes that don't
+        int wetSwitches[2] = {};
+        int previousLevels[numNodes] = {};
+
+        for (int blockIndex = 0; blockIndex < numBlocks; ++blockIndex)
+        {
+            const float load = peakNodeLoad * jmin(1.0f, (blockIndex + 1) / (float) rampBlocks);
+
+            for (auto* synthetic : loads)
+                synthetic->setLoad(load);
+
+            const int64 position = (int64) blockIndex * blockSize;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                float* input = block.getWritePointer(channel);
+
+                for (int i = 0; i < blockSize; ++i)
+                    input[i] = getInputSample(channel, position + i);
+            }
+
+            midi.clear();
+            graph.processBlock(block, midi);
+
+            // once no node has changed its gain for the chain's whole latency, the output is the
+            // input delayed by that latency and scaled by the product of the nodes' gains. A fade
+            // may end in the same block it's seen to be over, so that block doesn't count.
+            float steadyGain = 1.0f;
+            bool steady = true;
+
+            for (int i = 0; i < numNodes; ++i)
+            {
+                const int level = budgetedNodes[i]->getAppliedLevel();
+
+                steady = steady && ! budgetedNodes[i]->isTransitioning() && ! loads[i]->isRampingGain();
+                steadyGain *= level < budgetedNodes[i]->getBypassLevel() ? SyntheticLoadProcessor::getLevelGain(level) : 1.0f;
+                maxLevel = jmax(maxLevel, level);
+
+                if (level != previousLevels[i] && level < budgetedNodes[i]->getBypassLevel()
+                     && previousLevels[i] < budgetedNodes[i]->getBypassLevel())
+                    ++wetSwitches[i % 2];
+
+                previousLevels[i] = level;
+            }
+
+            steadySamples = steady ? steadySamples + blockSize : 0;
+            const bool checkAlignment = steadySamples - 2 * blockSize >= totalLatency;
+
+            if (checkAlignment)
+                checkedSamples += blockSize;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                const float* output = block.getReadPointer(channel);
+
+                for (int i = 0; i < blockSize; ++i)
+                {
+                    maxStep = jmax(maxStep, std::abs(output[i] - previousOutput[channel]));
+                    previousOutput[channel] = output[i];
+
+                    if (checkAlignment)
+                        maxAlignmentError = jmax(maxAlignmentError,
+                                                 std::abs(output[i] - steadyGain * getInputSample(channel, position + i - totalLatency)));
+                }
+            }
+        }
+
+        graph.releaseResources();
+
+        const int deadlineMisses = graph.getBudgetMonitor().getNumDeadlineMisses();
+
+        log(String(numBlocks) + " blocks of " + String(blockSize)
+             + ", deadline misses " + String(deadlineMisses) + " (allowed " + String(allowedDeadlineMisses) + ")"
+             + ", max step " + String(maxStep, 5) + " (input " + String(getMaximumInputStep(), 5) + ")"
+             + ", max alignment error " + String(maxAlignmentError, 7)
+             + " over " + String(checkedSamples) + " steady samples"
+             + ", most degraded level " + String(maxLevel)
+             + ", level switches " + String(wetSwitches[0]) + " crossfaded by the node, "
+             + String(wetSwitches[1]) + " through dry");
+
+        if (maxLevel == 0)
+            return fail("the load never made the monitor degrade a node");
+
+        if (wetSwitches[0] == 0 || wetSwitches[1] == 0)
+            return fail("the nodes didn't switch quality levels both ways");
+
+        if (checkedSamples == 0)
+            return fail("the chain was never steady for long enough to check its alignment");
+
+        if (maxStep > 1.5f * getMaximumInputStep())
+            return fail("discontinuity in the output");
+
+        if (maxAlignmentError > 1.0e-5f)
+            return fail("output drifted from the delayed, scaled input");
+
+        if (deadlineMisses > allowedDeadlineMisses)
+            return fail("too many missed deadlines");
+
+        return pass();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CpuStressTest)
+};
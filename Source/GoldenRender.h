@@ -0,0 +1,357 @@
+/*
+  ==============================================================================
+
+    GoldenRender.h
+
+    Offline regression harness for the graph wiring. Every stimulus file is
+    rendered through every named GraphConfiguration, block by block as the
+    audio device would, and the result is compared with a stored golden file
+    either bit-exactly or within a tolerance in ULPs. Each render is also
+    timed and compared with a reference time recorded on the same machine,
+    so one run shows both correctness and performance regressions.
+
+    Usage:
+
+        ProcessingAudioInputTutorial --golden-check <dir> [options]
+        ProcessingAudioInputTutorial --golden-record <dir> [options]
+
+    options:
+        --max-ulps <n>      allowed difference per sample in ULPs (default 0, bit-exact)
+        --block-size <n>    samples per processBlock call (default 64)
+        --config <name>     only render this configuration
+        --timing-runs <n>   renders of each stimulus to take the fastest time from (default 5)
+        --max-slowdown <n>  allowed increase in render time over the reference, in percent (default 25)
+        --record-timings    with --golden-check, replace the reference times with this run's
+
+    <dir>/stimulus/<name>.wav               input WAV files, any bit depth
+    <dir>/golden/<config>/<name>.wav        golden output, 32-bit float WAV
+    <dir>/golden-timings.csv                reference render time of every render
+    <dir>/golden-report.csv                 result and render time of every render
+
+    Render times depend on the machine, so the reference times aren't kept
+    with the goldens: --golden-record writes them, and so does a check run
+    with --record-timings, which is how to take a baseline on a new machine.
+    A check without reference times only reports the times. Each time is the
+    fastest of several renders, as a single render of a short stimulus is
+    mostly timer and scheduling noise.
+
+    The run fails if any render didn't match its golden file or was slower
+    than allowed.
+
+    The stimulus set and the goldens for every configuration are kept in
+    Golden/ at the top of the repository. Golden/run-golden-check.sh builds
+    the Linux app the way they were recorded and runs the check on them;
+    after an intended change to the output, re-record them with
+    Golden/run-golden-check.sh --record and commit the new files.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class GoldenRenderHarness   : public CommandLineHarness
+{
+public:
+    static StringArray getArguments()   { return { getCheckArgument(), getRecordArgument() }; }
+
+    // Run the harness for the given command line and return the process exit code
+    static int run(const StringArray& args)
+    {
+        GoldenRenderHarness harness;
+        const bool record = args.contains(getRecordArgument());
+        const String modeArgument = record ? getRecordArgument() : getCheckArgument();
+        const String directoryArgument = getArgumentValue(args, modeArgument);
+
+        if (directoryArgument.isEmpty())
+            return harness.fail("missing directory after " + modeArgument);
+
+        harness.directory = File::getCurrentWorkingDirectory().getChildFile(directoryArgument);
+        harness.recording = record;
+        harness.maxUlps = getArgumentValue(args, "--max-ulps").getLargeIntValue();
+        harness.blockSize = jmax(1, getArgumentValue(args, "--block-size", "64").getIntValue());
+        harness.onlyConfiguration = getArgumentValue(args, "--config");
+        harness.timingRuns = jmax(1, getArgumentValue(args, "--timing-runs", "5").getIntValue());
+        harness.maxSlowdownPercent = jmax(0.0, getArgumentValue(args, "--max-slowdown", "25").getDoubleValue());
+        harness.recordingTimings = record || args.contains("--record-timings");
+
+        return harness.runAll();
+    }
+
+private:
+    static const char* getCheckArgument()   { return "--golden-check"; }
+    static const char* getRecordArgument()  { return "--golden-record"; }
+
+    File directory;
+    bool recording = false;
+    int64 maxUlps = 0;
+    int blockSize = 64;
+    String onlyConfiguration;
+    int timingRuns = 5;
+    double maxSlowdownPercent = 25.0;
+    bool recordingTimings = false;
+
+    AudioFormatManager formatManager;
+    String report;
+
+    // Reference render seconds keyed by "<config>,<stimulus file>", and this run's
+    StringPairArray referenceTimings, timings;
+
+    GoldenRenderHarness()
+        : CommandLineHarness("golden")
+    {
+        formatManager.registerBasicFormats();
+    }
+
+    int runAll()
+    {
+        Array<File> stimuli = directory.getChildFile("stimulus").findChildFiles(File::findFiles, false, "*.wav");
+        stimuli.sort();
+
+        if (stimuli.isEmpty())
+            return fail("no stimulus files in " + directory.getChildFile("stimulus").getFullPathName());
+
+        if (onlyConfiguration.isNotEmpty() && GraphConfigurations::find(onlyConfiguration) == nullptr)
+            return fail("unknown configuration " + onlyConfiguration);
+
+        const File timingsFile = directory.getChildFile("golden-timings.csv");
+
+        if (! recordingTimings)
+            readTimings(timingsFile);
+
+        report = "config,stimulus,result,max_ulps,render_seconds,reference_seconds,realtime_factor\n";
+        int numFailures = 0;
+
+        for (auto& configuration : GraphConfigurations::getAll())
+        {
+            if (onlyConfiguration.isNotEmpty() && configuration.name != onlyConfiguration)
+                continue;
+
+            for (auto& stimulus : stimuli)
+                if (! renderAndCompare(configuration, stimulus))
+                    ++numFailures;
+        }
+
+        directory.getChildFile("golden-report.csv").replaceWithText(report);
+
+        if (numFailures > 0)
+            return fail(String(numFailures) + " render(s) did not match their golden files or were too slow");
+
+        if (recordingTimings)
+            writeTimings(timingsFile);
+        else if (referenceTimings.size() == 0)
+            log("no reference times in " + timingsFile.getFullPathName()
+                 + ", run with --record-timings to take them");
+
+        return pass("all renders " + String(recording ? "recorded" : "matched"));
+    }
+
+    bool renderAndCompare(const GraphConfiguration& configuration, const File& stimulusFile)
+    {
+        const File goldenFile = directory.getChildFile("golden").getChildFile(configuration.name)
+                                         .getChildFile(stimulusFile.getFileNameWithoutExtension() + ".wav");
+
+        AudioBuffer<float> stimulus;
+        double sampleRate = 0.0;
+
+        if (! readFile(stimulusFile, stimulus, sampleRate))
+            return addResult(configuration, stimulusFile, "unreadable-stimulus", 0, {});
+
+        // the output of the first render is the one compared, the rest are only timed
+        AudioBuffer<float> output, discarded;
+        double renderSeconds = render(configuration, stimulus, sampleRate, output);
+
+        for (int run = 1; run < timingRuns; ++run)
+            renderSeconds = jmin(renderSeconds, render(configuration, stimulus, sampleRate, discarded));
+
+        const String timingKey = configuration.name + "," + stimulusFile.getFileName();
+        timings.set(timingKey, String(renderSeconds, 9));
+
+        const double referenceSeconds = referenceTimings.getValue(timingKey, "0").getDoubleValue();
+        const double realtimeFactor = renderSeconds > 0.0 ? (stimulus.getNumSamples() / sampleRate) / renderSeconds : 0.0;
+        const Timing timing { renderSeconds, referenceSeconds, realtimeFactor };
+
+        if (recording)
+        {
+            const bool written = writeFile(goldenFile, output, sampleRate);
+            return addResult(configuration, stimulusFile, written ? "recorded" : "write-failed", 0, timing);
+        }
+
+        AudioBuffer<float> golden;
+        double goldenSampleRate = 0.0;
+
+        if (! readFile(goldenFile, golden, goldenSampleRate))
+            return addResult(configuration, stimulusFile, "missing-golden", 0, timing);
+
+        if (golden.getNumChannels() != output.getNumChannels() || golden.getNumSamples() != output.getNumSamples())
+            return addResult(configuration, stimulusFile, "size-mismatch", 0, timing);
+
+        const int64 ulps = getMaxUlpDistance(golden, output);
+
+        if (ulps > maxUlps)
+            return addResult(configuration, stimulusFile, "FAIL", ulps, timing);
+
+        if (referenceSeconds > 0.0 && renderSeconds > referenceSeconds * (1.0 + maxSlowdownPercent / 100.0))
+            return addResult(configuration, stimulusFile, "SLOW", ulps, timing);
+
+        return addResult(configuration, stimulusFile, "pass", ulps, timing);
+    }
+
+    struct Timing
+    {
+        double renderSeconds, referenceSeconds, realtimeFactor;
+    };
+
+    // Returns false for any result that isn't a pass (or a successful recording)
+    bool addResult(const GraphConfiguration& configuration, const File& stimulusFile, const String& result,
+                   int64 ulps, const Timing& timing)
+    {
+        const String line = configuration.name + "," + stimulusFile.getFileName() + "," + result + ","
+                             + String(ulps) + "," + String(timing.renderSeconds, 6) + ","
+                             + (timing.referenceSeconds > 0.0 ? String(timing.referenceSeconds, 6) : String()) + ","
+                             + String(timing.realtimeFactor, 1);
+
+        log(line);
+        report << line << "\n";
+
+        return result == "pass" || result == "recorded";
+    }
+
+    // Lines of "<config>,<stimulus file>,<seconds>"
+    void readTimings(const File& file)
+    {
+        StringArray lines;
+        lines.addLines(file.loadFileAsString());
+
+        for (auto& line : lines)
+        {
+            StringArray fields;
+            fields.addTokens(line, ",", {});
+
+            if (fields.size() == 3)
+                referenceTimings.set(fields[0] + "," + fields[1], fields[2]);
+        }
+    }
+
+    // Keeps the reference times of any renders this run skipped
+    void writeTimings(const File& file)
+    {
+        readTimings(file);
+
+        for (auto& key : timings.getAllKeys())
+            referenceTimings.set(key, timings[key]);
+
+        String text;
+
+        for (auto& key : referenceTimings.getAllKeys())
+            text << key << "," << referenceTimings[key] << "\n";
+
+        file.replaceWithText(text);
+    }
+
+    // Renders the stimulus through a freshly built graph and returns the time spent in processBlock
+    double render(const GraphConfiguration& configuration, const AudioBuffer<float>& stimulus,
+                  double sampleRate, AudioBuffer<float>& output)
+    {
+        const int numChannels = stimulus.getNumChannels();
+        const int numSamples = stimulus.getNumSamples();
+
+        BudgetedProcessorGraph graph;
+        graph.setNonRealtime(true);
+        graph.setPlayConfigDetails(numChannels, numChannels, sampleRate, blockSize);
+        graph.setProcessingPrecision(AudioProcessor::singlePrecision);
+
+        configuration.build(graph, numChannels);
+
+        graph.prepareToPlay(sampleRate, blockSize);
+
+        output.setSize(numChannels, numSamples);
+        AudioBuffer<float> block(numChannels, blockSize);
+        MidiBuffer midi;
+        int64 renderTicks = 0;
+
+        for (int position = 0; position < numSamples; position += blockSize)
+        {
+            const int numThisTime = jmin(blockSize, numSamples - position);
+            AudioBuffer<float> blockView(block.getArrayOfWritePointers(), numChannels, numThisTime);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                blockView.copyFrom(channel, 0, stimulus, channel, position, numThisTime);
+
+            midi.clear();
+
+            const int64 startTicks = Time::getHighResolutionTicks();
+            graph.processBlock(blockView, midi);
+            renderTicks += Time::getHighResolutionTicks() - startTicks;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                output.copyFrom(channel, position, blockView, channel, 0, numThisTime);
+        }
+
+        graph.releaseResources();
+
+        return Time::highResolutionTicksToSeconds(renderTicks);
+    }
+
+    bool readFile(const File& file, AudioBuffer<float>& buffer, double& sampleRate)
+    {
+        std::unique_ptr<AudioFormatReader> reader(formatManager.createReaderFor(file));
+
+        if (reader == nullptr)
+            return false;
+
+        buffer.setSize((int) reader->numChannels, (int) reader->lengthInSamples);
+        reader->read(&buffer, 0, buffer.getNumSamples(), 0, true, true);
+        sampleRate = reader->sampleRate;
+
+        return true;
+    }
+
+    // Golden files are 32-bit float so they round trip bit-exactly
+    static bool writeFile(const File& file, const AudioBuffer<float>& buffer, double sampleRate)
+    {
+        file.getParentDirectory().createDirectory();
+        file.deleteFile();
+
+        std::unique_ptr<FileOutputStream> stream(file.createOutputStream());
+
+        if (stream == nullptr)
+            return false;
+
+        WavAudioFormat wavFormat;
+        std::unique_ptr<AudioFormatWriter> writer(wavFormat.createWriterFor(stream.get(), sampleRate,
+                                                                            (unsigned int) buffer.getNumChannels(),
+                                                                            32, {}, 0));
+        if (writer == nullptr)
+            return false;
+
+        stream.release();
+        return writer->writeFromAudioSampleBuffer(buffer, 0, buffer.getNumSamples());
+    }
+
+    // Maps a float onto an integer line where adjacent floats are one apart
+    static int64 getOrderedBits(float value)
+    {
+        int32 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits < 0 ? (int64) std::numeric_limits<int32>::min() - bits : (int64) bits;
+    }
+
+    static int64 getMaxUlpDistance(const AudioBuffer<float>& a, const AudioBuffer<float>& b)
+    {
+        int64 maxDistance = 0;
+
+        for (int channel = 0; channel < a.getNumChannels(); ++channel)
+        {
+            const float* aSamples = a.getReadPointer(channel);
+            const float* bSamples = b.getReadPointer(channel);
+
+            for (int i = 0; i < a.getNumSamples(); ++i)
+                maxDistance = jmax(maxDistance, std::abs(getOrderedBits(aSamples[i]) - getOrderedBits(bSamples[i])));
+        }
+
+        return maxDistance;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GoldenRenderHarness)
+};
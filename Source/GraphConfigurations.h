@@ -0,0 +1,112 @@
+/*
+  ==============================================================================
+
+    GraphConfigurations.h
+
+    The named ways of wiring the graph between its input and output nodes.
+    prepareToPlay builds the live graph from one of these, and the golden
+    render harness builds the same configurations offline, so any change to
+    the wiring is checked against the stored golden output.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+struct GraphConfiguration
+{
+    String name;
+
+    // Adds the nodes and connections to an empty graph with the given number of
+    // input and output channels; called before the graph is prepared
+    std::function<void (AudioProcessorGraph& graph, int numChannels)> build;
+};
+
+//==============================================================================
+class GraphConfigurations
+{
+public:
+    // The name of the configuration the live graph runs
+    static String getLiveName()     { return "looper"; }
+
+    static const Array<GraphConfiguration>& getAll()
+    {
+        static const Array<GraphConfiguration> configurations
+        {
+            GraphConfiguration { "passthrough",    [] (AudioProcessorGraph& graph, int numChannels) { buildPassthrough(graph, numChannels); } },
+            GraphConfiguration { "oversampled-x2", [] (AudioProcessorGraph& graph, int numChannels) { buildOversampled(graph, numChannels, 2); } },
+            GraphConfiguration { "oversampled-x4", [] (AudioProcessorGraph& graph, int numChannels) { buildOversampled(graph, numChannels, 4); } },
+            GraphConfiguration { "oversampled-x8", [] (AudioProcessorGraph& graph, int numChannels) { buildOversampled(graph, numChannels, 8); } },
+            GraphConfiguration { "looper",         [] (AudioProcessorGraph& graph, int numChannels) { buildLooper(graph, numChannels); } },
+        };
+
+        return configurations;
+    }
+
+    // Returns nullptr if there is no configuration with that name
+    static const GraphConfiguration* find(const String& name)
+    {
+        for (auto& configuration : getAll())
+            if (configuration.name == name)
+                return &configuration;
+
+        return nullptr;
+    }
+
+private:
+    // Input straight to output, channel for channel
+    static void buildPassthrough(AudioProcessorGraph& graph, int numChannels)
+    {
+        AudioProcessorGraph::Node::Ptr inputNodePtr = addIONode(graph, AudioProcessorGraph::AudioGraphIOProcessor::audioInputNode);
+        AudioProcessorGraph::Node::Ptr outputNodePtr = addIONode(graph, AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode);
+
+        for (int i = 0; i < numChannels; i++)
+        {
+            graph.addConnection({ { inputNodePtr->nodeID, i }, { outputNodePtr->nodeID, i } });
+        }
+    }
+
+    // Input to output through an empty oversampled subgraph, which exercises
+    // just the resampling filters
+    static void buildOversampled(AudioProcessorGraph& graph, int numChannels, int factor)
+    {
+        AudioProcessorGraph::Node::Ptr inputNodePtr = addIONode(graph, AudioProcessorGraph::AudioGraphIOProcessor::audioInputNode);
+        AudioProcessorGraph::Node::Ptr outputNodePtr = addIONode(graph, AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode);
+
+        OversampledSubgraphProcessor* oversampled = new OversampledSubgraphProcessor(numChannels, factor);
+        AudioProcessorGraph& subgraph = oversampled->getSubgraph();
+        AudioProcessorGraph::Node::Ptr oversampledNodePtr = graph.addNode(oversampled);
+
+        for (int i = 0; i < numChannels; i++)
+        {
+            subgraph.addConnection({ { oversampled->getSubgraphInputNode()->nodeID, i }, { oversampled->getSubgraphOutputNode()->nodeID, i } });
+            graph.addConnection({ { inputNodePtr->nodeID, i }, { oversampledNodePtr->nodeID, i } });
+            graph.addConnection({ { oversampledNodePtr->nodeID, i }, { outputNodePtr->nodeID, i } });
+        }
+    }
+
+    // Input to output through a looper, which spills its layers to a new folder in the
+    // temp directory. Until something is recorded it passes its input straight through.
+    static void buildLooper(AudioProcessorGraph& graph, int numChannels)
+    {
+        AudioProcessorGraph::Node::Ptr inputNodePtr = addIONode(graph, AudioProcessorGraph::AudioGraphIOProcessor::audioInputNode);
+        AudioProcessorGraph::Node::Ptr outputNodePtr = addIONode(graph, AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode);
+
+        const File spillDirectory = File::getSpecialLocation(File::tempDirectory)
+                                        .getNonexistentChildFile("ProcessingAudioInputTutorial-looper", {}, false);
+        AudioProcessorGraph::Node::Ptr looperNodePtr = graph.addNode(new SpillingLooperProcessor(numChannels, spillDirectory));
+
+        for (int i = 0; i < numChannels; i++)
+        {
+            graph.addConnection({ { inputNodePtr->nodeID, i }, { looperNodePtr->nodeID, i } });
+            graph.addConnection({ { looperNodePtr->nodeID, i }, { outputNodePtr->nodeID, i } });
+        }
+    }
+
+    static AudioProcessorGraph::Node::Ptr addIONode(AudioProcessorGraph& graph,
+                                                    AudioProcessorGraph::AudioGraphIOProcessor::IODeviceType type)
+    {
+        return graph.addNode(new AudioProcessorGraph::AudioGraphIOProcessor(type));
+    }
+};
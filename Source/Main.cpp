@@ -8,6 +8,12 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "ProcessingAudioInputTutorial.h"
+#include "CommandLineHarness.h"
+#include "GoldenRender.h"
+#include "CpuStressTest.h"
+#include "OversamplingBenchmark.h"
+#include "SpillingLooperTest.h"
+#include "TraceBenchmark.h"
 
 class Application    : public JUCEApplication
 {
@@ -18,10 +24,37 @@ public:
     const String getApplicationName() override       { return "ProcessingAudioInputTutorial"; }
     const String getApplicationVersion() override    { return "1.0.0"; }
 
-    void initialise (const String&) override         { mainWindow.reset (new MainWindow ("ProcessingAudioInputTutorial", new MainContentComponent(), *this)); }
+    void initialise (const String&) override
+    {
+        // the test harnesses run headless, without opening the window or the audio device
+        if (runIfRequested<GoldenRenderHarness>()
+             || runIfRequested<CpuStressTest>()
+             || runIfRequested<OversamplingBenchmark>()
+             || runIfRequested<SpillingLooperTest>()
+             || runIfRequested<TraceBenchmark>())
+            return;
+
+        mainWindow.reset (new MainWindow ("ProcessingAudioInputTutorial", new MainContentComponent(), *this));
+    }
+
     void shutdown() override                         { mainWindow = nullptr; }
 
 private:
+    // Runs the harness and quits if the command line asks for it
+    template <typename Harness>
+    bool runIfRequested()
+    {
+        const StringArray args (getCommandLineParameterArray());
+
+        if (! CommandLineHarness::isRequested<Harness> (args))
+            return false;
+
+        setApplicationReturnValue (Harness::run (args));
+        quit();
+        return true;
+    }
+
+    //==============================================================================
     class MainWindow    : public DocumentWindow
     {
     public:
@@ -0,0 +1,370 @@
+/*
+  ==============================================================================
+
+    Oversampling.h
+
+    Runs a subgraph at 2x, 4x or 8x the graph's sample rate, so nonlinear
+    nodes can be inserted after the input node without aliasing, while the
+    rest of the graph stays at the device rate.
+
+    The rate changes are done with cascaded polyphase half-band FIR filters.
+    Each stage splits its filter into the two polyphase branches: one branch
+    is a pure delay (the half-band centre tap), the other only has the odd
+    taps, so every stage costs half a tap per output sample. The branch
+    filters are evaluated a whole block at a time with FloatVectorOperations,
+    which JUCE vectorizes for the target CPU.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+// A linear phase half-band lowpass filter, used for 2x upsampling and 2x
+// downsampling of a fixed number of channels.
+class HalfBandFilter
+{
+public:
+    // numBranchTaps is the number of taps in the non-trivial polyphase branch
+    // (must be even); the full filter has 2 * numBranchTaps - 1 taps
+    HalfBandFilter(int numBranchTaps)
+        : branchTaps(numBranchTaps)
+    {
+        jassert(numBranchTaps >= 2 && numBranchTaps % 2 == 0);
+
+        // windowed sinc design: the full filter's odd offsets from the centre
+        // tap are the branch taps, the even ones are all zero
+        const int numTaps = 2 * numBranchTaps - 1;
+        const int centre = numBranchTaps - 1;
+        double sum = 0.0;
+
+        for (int i = 0; i < numBranchTaps; ++i)
+        {
+            const int tap = 2 * i;
+            const int offset = tap - centre;
+            const double sinc = std::sin(MathConstants<double>::halfPi * offset) / (MathConstants<double>::pi * offset);
+            const double phase = MathConstants<double>::twoPi * tap / (numTaps - 1);
+            const double blackman = 0.42 - 0.5 * std::cos(phase) + 0.08 * std::cos(2.0 * phase);
+
+            coefficients.add((float) (sinc * blackman));
+            sum += sinc * blackman;
+        }
+
+        // normalise so the branch (and therefore the whole filter) has unity gain at DC
+        for (auto& coefficient : coefficients)
+            coefficient = (float) (coefficient * 0.5 / sum);
+    }
+
+    // Allocate the filter state for the given number of channels; maximumLowRateSamples
+    // is the largest number of low rate samples that will be processed at once
+    void prepare(int numChannels, int maximumLowRateSamples)
+    {
+        upHistory.setSize(numChannels, branchTaps - 1 + maximumLowRateSamples);
+        downEvenHistory.setSize(numChannels, branchTaps - 1 + maximumLowRateSamples);
+        downOddHistory.setSize(numChannels, branchTaps / 2 + maximumLowRateSamples);
+        scratch.setSize(1, maximumLowRateSamples);
+        maximumSamples = maximumLowRateSamples;
+
+        reset();
+    }
+
+    void reset()
+    {
+        upHistory.clear();
+        downEvenHistory.clear();
+        downOddHistory.clear();
+    }
+
+    // Upsample numSamples from source into 2 * numSamples at dest
+    void upsample(int channel, const float* source, float* dest, int numSamples)
+    {
+        jassert(numSamples <= maximumSamples);
+
+        float* history = upHistory.getWritePointer(channel);
+        float* even = scratch.getWritePointer(0);
+        const int offset = branchTaps - 1;
+
+        FloatVectorOperations::copy(history + offset, source, numSamples);
+
+        // the zero-stuffed samples only see the branch taps...
+        FloatVectorOperations::clear(even, numSamples);
+
+        for (int i = 0; i < branchTaps; ++i)
+            FloatVectorOperations::addWithMultiply(even, history + offset - i, 2.0f * coefficients.getUnchecked(i), numSamples);
+
+        // ...and the input samples only see the centre tap, i.e. a delay
+        const float* odd = history + branchTaps / 2;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            dest[2 * i] = even[i];
+            dest[2 * i + 1] = odd[i];
+        }
+
+        std::memmove(history, history + numSamples, sizeof(float) * (size_t) offset);
+    }
+
+    // Downsample 2 * numSamples from source into numSamples at dest
+    void downsample(int channel, const float* source, float* dest, int numSamples)
+    {
+        jassert(numSamples <= maximumSamples);
+
+        float* evenHistory = downEvenHistory.getWritePointer(channel);
+        float* oddHistory = downOddHistory.getWritePointer(channel);
+        const int evenOffset = branchTaps - 1;
+        const int oddOffset = branchTaps / 2;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            evenHistory[evenOffset + i] = source[2 * i];
+            oddHistory[oddOffset + i] = source[2 * i + 1];
+        }
+
+        FloatVectorOperations::copyWithMultiply(dest, oddHistory, 0.5f, numSamples);
+
+        for (int i = 0; i < branchTaps; ++i)
+            FloatVectorOperations::addWithMultiply(dest, evenHistory + evenOffset - i, coefficients.getUnchecked(i), numSamples);
+
+        std::memmove(evenHistory, evenHistory + numSamples, sizeof(float) * (size_t) evenOffset);
+        std::memmove(oddHistory, oddHistory + numSamples, sizeof(float) * (size_t) oddOffset);
+    }
+
+    // The delay of one pass through the filter, in high rate samples
+    int getLatencyHighRateSamples() const   { return branchTaps - 1; }
+
+private:
+    const int branchTaps;
+    Array<float> coefficients;
+
+    AudioBuffer<float> upHistory;
+    AudioBuffer<float> downEvenHistory;
+    AudioBuffer<float> downOddHistory;
+    AudioBuffer<float> scratch;
+    int maximumSamples = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HalfBandFilter)
+};
+
+//==============================================================================
+// Runs its own AudioProcessorGraph at a multiple of the parent graph's sample rate.
+// Only the channels this node is created with are resampled, so only the channels
+// routed into it in the parent graph cost anything. The filters' latency and the
+// subgraph's own latency are reported to the parent graph, scaled to its rate; when
+// that isn't a whole number of the parent's samples, the oversampled signal is
+// delayed by the few extra high rate samples that make it one.
+class OversampledSubgraphProcessor   : public AudioProcessor
+{
+public:
+    // factor must be 2, 4 or 8
+    OversampledSubgraphProcessor(int numChannelsToProcess, int oversamplingFactor)
+        : AudioProcessor(BusesProperties()
+                            .withInput("Input", AudioChannelSet::discreteChannels(numChannelsToProcess), true)
+                            .withOutput("Output", AudioChannelSet::discreteChannels(numChannelsToProcess), true)),
+          numChannels(numChannelsToProcess),
+          factor(oversamplingFactor)
+    {
+        jassert(factor == 2 || factor == 4 || factor == 8);
+
+        // the first stage keeps everything below 0.45 of the base rate flat to within 0.002dB
+        // and holds its image at least 73dB down from 0.55 of the base rate up: at 44.1kHz,
+        // flat to 19.8kHz with the image gone from 24.3kHz. The later stages only have to
+        // reject the images of that band, which land much further from their passbands, so
+        // they can be shorter: 14 branch taps keep them 76dB down at the second stage and
+        // 10 keep them 84dB down at the third
+        static const int branchTapsPerStage[] = { 56, 14, 10 };
+
+        for (int i = 0; (2 << i) <= factor; ++i)
+            stages.add(new HalfBandFilter(branchTapsPerStage[i]));
+
+        // the IO nodes take their channel counts from the graph when they're added
+        subgraph.setPlayConfigDetails(numChannels, numChannels, 44100.0 * factor, 512 * factor);
+
+        inputNode = subgraph.addNode(new AudioProcessorGraph::AudioGraphIOProcessor(
+            AudioProcessorGraph::AudioGraphIOProcessor::audioInputNode));
+
+        outputNode = subgraph.addNode(new AudioProcessorGraph::AudioGraphIOProcessor(
+            AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode));
+    }
+
+    //==============================================================================
+    // The graph that runs at the oversampled rate. It starts out with just its input
+    // and output nodes and no connections; add nodes and connect them between the two,
+    // then re-prepare this processor so the new latency is reported.
+    AudioProcessorGraph& getSubgraph()                  { return subgraph; }
+    AudioProcessorGraph::Node::Ptr getSubgraphInputNode() const     { return inputNode; }
+    AudioProcessorGraph::Node::Ptr getSubgraphOutputNode() const    { return outputNode; }
+
+    int getOversamplingFactor() const                   { return factor; }
+
+    //==============================================================================
+    const String getName() const override               { return "Oversampled x" + String(factor); }
+
+    void prepareToPlay(double sampleRate, int maximumExpectedSamplesPerBlock) override
+    {
+        int stageSamples = maximumExpectedSamplesPerBlock;
+        stageBuffers.clear();
+
+        for (auto* stage : stages)
+        {
+            stage->prepare(numChannels, stageSamples);
+            stageSamples *= 2;
+            stageBuffers.add(new AudioBuffer<float>(numChannels, stageSamples));
+        }
+
+        subgraph.setPlayConfigDetails(numChannels, numChannels, sampleRate * factor, maximumExpectedSamplesPerBlock * factor);
+        subgraph.setProcessingPrecision(AudioProcessor::singlePrecision);
+        subgraph.prepareToPlay(sampleRate * factor, maximumExpectedSamplesPerBlock * factor);
+
+        oversampledMidi.ensureSize(4096);
+
+        const int highRateLatency = getFilterLatencyHighRateSamples() + subgraph.getLatencySamples();
+        alignmentDelaySamples = (factor - highRateLatency % factor) % factor;
+        alignmentDelay.setSize(numChannels, alignmentDelaySamples + maximumExpectedSamplesPerBlock * factor);
+        alignmentDelay.clear();
+
+        setLatencySamples((highRateLatency + alignmentDelaySamples) / factor);
+    }
+
+    void releaseResources() override
+    {
+        subgraph.releaseResources();
+        stageBuffers.clear();
+        alignmentDelay.setSize(0, 0);
+    }
+
+    void processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override
+    {
+        TRACE_SCOPE("Oversampled subgraph");
+
+        const int numSamples = buffer.getNumSamples();
+        const int numStages = stages.size();
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const float* source = buffer.getReadPointer(channel);
+            int stageSamples = numSamples;
+
+            for (int i = 0; i < numStages; ++i)
+            {
+                float* dest = stageBuffers.getUnchecked(i)->getWritePointer(channel);
+                stages.getUnchecked(i)->upsample(channel, source, dest, stageSamples);
+                source = dest;
+                stageSamples *= 2;
+            }
+        }
+
+        AudioBuffer<float>& oversampled = *stageBuffers.getLast();
+        AudioBuffer<float> oversampledBlock(oversampled.getArrayOfWritePointers(), numChannels, numSamples * factor);
+
+        if (alignmentDelaySamples > 0)
+            delayForAlignment(oversampledBlock);
+
+        oversampledMidi.clear();
+
+        for (MidiBuffer::Iterator it(midiMessages); ; )
+        {
+            MidiMessage message;
+            int samplePosition;
+
+            if (! it.getNextEvent(message, samplePosition))
+                break;
+
+            oversampledMidi.addEvent(message, samplePosition * factor);
+        }
+
+        {
+            // nodes added to the subgraph rebuild its render sequence under this lock
+            const ScopedLock sl(subgraph.getCallbackLock());
+            subgraph.processBlock(oversampledBlock, oversampledMidi);
+        }
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            int stageSamples = numSamples << (numStages - 1);
+
+            for (int i = numStages - 1; i >= 0; --i)
+            {
+                const float* source = stageBuffers.getUnchecked(i)->getReadPointer(channel);
+                float* dest = i > 0 ? stageBuffers.getUnchecked(i - 1)->getWritePointer(channel)
+                                    : buffer.getWritePointer(channel);
+
+                stages.getUnchecked(i)->downsample(channel, source, dest, stageSamples);
+                stageSamples /= 2;
+            }
+        }
+    }
+
+    void reset() override
+    {
+        for (auto* stage : stages)
+            stage->reset();
+
+        alignmentDelay.clear();
+        subgraph.reset();
+    }
+
+    double getTailLengthSeconds() const override        { return subgraph.getTailLengthSeconds(); }
+    bool acceptsMidi() const override                   { return true; }
+    bool producesMidi() const override                  { return false; }
+
+    AudioProcessorEditor* createEditor() override       { return nullptr; }
+    bool hasEditor() const override                     { return false; }
+
+    int getNumPrograms() override                       { return 1; }
+    int getCurrentProgram() override                    { return 0; }
+    void setCurrentProgram(int) override                {}
+    const String getProgramName(int) override           { return {}; }
+    void changeProgramName(int, const String&) override {}
+
+    void getStateInformation(MemoryBlock&) override     {}
+    void setStateInformation(const void*, int) override {}
+
+private:
+    const int numChannels;
+    const int factor;
+
+    // stage i converts between factor 2^i and 2^(i+1); stageBuffers[i] holds its high rate side
+    OwnedArray<HalfBandFilter> stages;
+    OwnedArray<AudioBuffer<float>> stageBuffers;
+
+    AudioProcessorGraph subgraph;
+    AudioProcessorGraph::Node::Ptr inputNode;
+    AudioProcessorGraph::Node::Ptr outputNode;
+    MidiBuffer oversampledMidi;
+
+    // holds alignmentDelaySamples of history, then the current block
+    AudioBuffer<float> alignmentDelay;
+    int alignmentDelaySamples = 0;
+
+    // The round trip delay of the filters, in samples at the oversampled rate
+    int getFilterLatencyHighRateSamples() const
+    {
+        int latency = 0;
+        int stageFactor = 2;
+
+        for (auto* stage : stages)
+        {
+            // one pass up and one pass down, both at this stage's high rate
+            latency += 2 * stage->getLatencyHighRateSamples() * (factor / stageFactor);
+            stageFactor *= 2;
+        }
+
+        return latency;
+    }
+
+    void delayForAlignment(AudioBuffer<float>& block)
+    {
+        const int numSamples = block.getNumSamples();
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            float* delayed = alignmentDelay.getWritePointer(channel);
+
+            FloatVectorOperations::copy(delayed + alignmentDelaySamples, block.getReadPointer(channel), numSamples);
+            block.copyFrom(channel, 0, delayed, numSamples);
+            std::memmove(delayed, delayed + numSamples, sizeof(float) * (size_t) alignmentDelaySamples);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OversampledSubgraphProcessor)
+};
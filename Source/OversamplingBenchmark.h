@@ -0,0 +1,110 @@
+/*
+  ==============================================================================
+
+    OversamplingBenchmark.h
+
+    Measures what an OversampledSubgraphProcessor costs for each oversampling
+    factor and channel count. The subgraph is left empty apart from a
+    straight connection from its input to its output, so the figures are the
+    cost of the resampling filters plus the subgraph's own overhead.
+
+    Usage:
+
+        ProcessingAudioInputTutorial --oversampling-benchmark [options]
+
+    options:
+        --seconds <n>       length of audio to render for each case (default 10)
+        --block-size <n>    samples per processBlock call (default 64)
+        --sample-rate <n>   base sample rate (default 48000)
+
+    Each case is logged as the time per sample per channel, and as the share
+    of one core a realtime stream would use.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class OversamplingBenchmark   : public CommandLineHarness
+{
+public:
+    static StringArray getArguments()   { return { "--oversampling-benchmark" }; }
+
+    // Run the benchmark and return the process exit code
+    static int run(const StringArray& args)
+    {
+        OversamplingBenchmark benchmark;
+        benchmark.seconds = jmax(0.1, getArgumentValue(args, "--seconds", "10").getDoubleValue());
+        benchmark.blockSize = jmax(1, getArgumentValue(args, "--block-size", "64").getIntValue());
+        benchmark.sampleRate = jmax(1.0, getArgumentValue(args, "--sample-rate", "48000").getDoubleValue());
+
+        benchmark.log("factor,channels,ns_per_sample_per_channel,realtime_cpu_percent");
+
+        for (int factor = 2; factor <= 8; factor *= 2)
+            for (int numChannels = 1; numChannels <= 8; numChannels *= 2)
+                benchmark.runCase(factor, numChannels);
+
+        return 0;
+    }
+
+private:
+    double seconds = 10.0;
+    int blockSize = 64;
+    double sampleRate = 48000.0;
+    Random random { 1 };
+
+    OversamplingBenchmark()
+        : CommandLineHarness("oversampling-bench")
+    {
+    }
+
+    void runCase(int factor, int numChannels)
+    {
+        OversampledSubgraphProcessor oversampled(numChannels, factor);
+        AudioProcessorGraph& subgraph = oversampled.getSubgraph();
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            subgraph.addConnection({ { oversampled.getSubgraphInputNode()->nodeID, channel },
+                                     { oversampled.getSubgraphOutputNode()->nodeID, channel } });
+
+        oversampled.setPlayConfigDetails(numChannels, numChannels, sampleRate, blockSize);
+        oversampled.prepareToPlay(sampleRate, blockSize);
+
+        AudioBuffer<float> block(numChannels, blockSize);
+        MidiBuffer midi;
+
+        const int numBlocks = jmax(1, roundToInt(seconds * sampleRate / blockSize));
+        const int numWarmUpBlocks = jmin(numBlocks, 100);
+        int64 renderTicks = 0;
+
+        for (int blockIndex = -numWarmUpBlocks; blockIndex < numBlocks; ++blockIndex)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                float* samples = block.getWritePointer(channel);
+
+                for (int i = 0; i < blockSize; ++i)
+                    samples[i] = random.nextFloat() * 2.0f - 1.0f;
+            }
+
+            const int64 startTicks = Time::getHighResolutionTicks();
+            oversampled.processBlock(block, midi);
+
+            if (blockIndex >= 0)
+                renderTicks += Time::getHighResolutionTicks() - startTicks;
+        }
+
+        oversampled.releaseResources();
+
+        const double renderSeconds = Time::highResolutionTicksToSeconds(renderTicks);
+        const double numSamples = (double) numBlocks * blockSize;
+        const double nanosecondsPerSample = renderSeconds * 1.0e9 / (numSamples * numChannels);
+        const double realtimePercent = 100.0 * renderSeconds / (numSamples / sampleRate);
+
+        log(String(factor) + "," + String(numChannels) + ","
+             + String(nanosecondsPerSample, 2) + "," + String(realtimePercent, 3));
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OversamplingBenchmark)
+};
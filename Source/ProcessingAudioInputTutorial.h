@@ -47,13 +47,28 @@
 
 #pragma once
 
+#include <stdexcept>
+
+#include "TraceCapture.h"
+#include "CpuBudget.h"
+#include "Oversampling.h"
+#include "SpillingLooper.h"
+#include "GraphConfigurations.h"
+
 //==============================================================================
-class MainContentComponent   : public AudioAppComponent
+class MainContentComponent   : public AudioAppComponent,
+                               private Timer
 {
 public:
     //==============================================================================
     MainContentComponent()
     {
+       #if ENABLE_TRACE_CAPTURE
+        // allocate the trace buffers here rather than on the audio thread
+        TraceCapture::getInstance();
+        setWantsKeyboardFocus(true);
+       #endif
+
         levelSlider.setRange (0.0, 0.25);
         levelSlider.setTextBoxStyle (Slider::TextBoxRight, false, 50, 20);
         levelLabel.setText ("Noise Level", dontSendNotification);
@@ -62,6 +77,10 @@ public:
         addAndMakeVisible(levelLabel);
         addAndMakeVisible(infoLabel);
 
+        recordButton.setButtonText("Record");
+        recordButton.onClick = [this] { toggleRecording(); };
+        addAndMakeVisible(recordButton);
+
         setSize (800, 100);
 
         // we deliberately don't call this
@@ -70,6 +89,9 @@ public:
         // instead we call prepareToPlay directly
         // the parameters are actually ignored
         prepareToPlay(0, 0);
+
+        // an overdub stops by itself after one pass, so the button follows the looper
+        startTimerHz(10);
     }
 
     ~MainContentComponent()
@@ -80,6 +102,8 @@ public:
     // Set the buffer size of the current device to the minimum supported size
     void setBufferSizeToMinimum()
     {
+        TRACE_SCOPE("setBufferSizeToMinimum");
+
         // Set buffer size to minimum available on current device
         auto* device = deviceManager.getCurrentAudioDevice();
 
@@ -101,14 +125,14 @@ public:
                 String result = deviceManager.setAudioDeviceSetup(setup, false);
                 if (result.length() > 0)
                 {
-                    throw std::exception(result.getCharPointer());
+                    throw std::runtime_error(result.toStdString());
                 }
             }
 
             if (minBufferSize != device->getCurrentBufferSizeSamples())
             {
                 // die horribly
-                throw std::exception("Can't set buffer size to minimum");
+                throw std::runtime_error("Can't set buffer size to minimum");
             }
         }
     }
@@ -131,6 +155,8 @@ public:
     // the MainContentComponent() constructor via the setChannels(2, 2) call.
     void prepareToPlay(int, double) override
     {
+        TRACE_SCOPE("prepareToPlay");
+
         const OwnedArray<AudioIODeviceType>& deviceTypes = deviceManager.getAvailableDeviceTypes();
         // if true, matchString will be considered a substring; if false, an exact match
         String desiredTypeName{L""};
@@ -153,17 +179,23 @@ public:
 
         if (desiredTypeName.length() > 0)
         {
+            TRACE_SCOPE("setCurrentAudioDeviceType");
             deviceManager.setCurrentAudioDeviceType(desiredTypeName, /*treatAsChosenDevice*/ false);
         }
         else
         {
-            throw std::exception("Could not set audio device type to desired type name");
+            throw std::runtime_error("Could not set audio device type to desired type name");
+        }
+
+        String result;
+        {
+            TRACE_SCOPE("initialiseWithDefaultDevices");
+            result = deviceManager.initialiseWithDefaultDevices(2, 2);
         }
 
-        String result = deviceManager.initialiseWithDefaultDevices(2, 2);
         if (result.length() > 0)
         {
-            throw std::exception(result.getCharPointer());
+            throw std::runtime_error(result.toStdString());
         }
         
         player.setProcessor(&graph);
@@ -175,7 +207,7 @@ public:
 
         if (device->getTypeName() != desiredTypeName)
         {
-            throw std::exception("Device type names don't match");
+            throw std::runtime_error("Device type names don't match");
         }
 
         BigInteger activeInputChannels = device->getActiveInputChannels();
@@ -188,7 +220,7 @@ public:
 
         if (maxInputChannels != maxOutputChannels)
         {
-            throw std::exception("Don't yet support different numbers of input vs output channels");
+            throw std::runtime_error("Don't yet support different numbers of input vs output channels");
         }
 
         String label;
@@ -202,7 +234,10 @@ public:
         AppendToString(label, String(maxInputChannels));
         AppendToString(label, L", maxout ");
         AppendToString(label, String(maxOutputChannels));
-        infoLabel.setText(label, NotificationType::dontSendNotification);
+        {
+            TRACE_SCOPE("infoLabel update");
+            infoLabel.setText(label, NotificationType::dontSendNotification);
+        }
 
         graph.setPlayConfigDetails(
             maxInputChannels,
@@ -213,57 +248,114 @@ public:
         // TBD: is double better?  Single (e.g. float32) definitely best for starters though
         graph.setProcessingPrecision(AudioProcessor::singlePrecision);
 
-        graph.prepareToPlay(device->getCurrentSampleRate(), device->getCurrentBufferSizeSamples());
-
-        AudioProcessorGraph::AudioGraphIOProcessor* input =
-            new AudioProcessorGraph::AudioGraphIOProcessor(
-                AudioProcessorGraph::AudioGraphIOProcessor::audioInputNode);
-
-        AudioProcessorGraph::AudioGraphIOProcessor* output =
-            new AudioProcessorGraph::AudioGraphIOProcessor(
-                AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode);
-
         //mOsc1Node = new OscillatorNode();
         //mOsc1Node->setPlayConfigDetails(getNumInputChannels(), getNumOutputChannels(), sampleRate, samplesPerBlock);
 
-        AudioProcessorGraph::Node::Ptr inputNodePtr = graph.addNode(input);
-        AudioProcessorGraph::Node::Ptr outputNodePtr = graph.addNode(output);
+        // the wiring lives in GraphConfigurations so the golden render harness can check it offline;
+        // like the harness, it's built before the graph is prepared
+        GraphConfigurations::find(GraphConfigurations::getLiveName())->build(graph, maxInputChannels);
 
-        for (int i = 0; i < maxInputChannels; i++)
         {
-            graph.addConnection({ { inputNodePtr->nodeID, i }, { outputNodePtr->nodeID, i } });
+            TRACE_SCOPE("graph prepareToPlay");
+            graph.prepareToPlay(device->getCurrentSampleRate(), device->getCurrentBufferSizeSamples());
         }
+
+        looper = findLooper();
     }
 
     void getNextAudioBlock(const juce::AudioSourceChannelInfo &) override
     {
-        throw std::exception("This method should never be called since the AudioProcessorPlayer should be the callback");
+        throw std::runtime_error("This method should never be called since the AudioProcessorPlayer should be the callback");
     }
 
     void releaseResources() override
     {
         player.setProcessor(nullptr);
+        looper = nullptr;
         graph.clear();
     }
 
     void resized() override
     {
+        TRACE_SCOPE("resized");
+
         const int width = 100;
 
         levelLabel.setBounds(10, 10, width - 10, 20);
         levelSlider.setBounds (100, 10, getWidth() - (width + 10), 20);
 
         infoLabel.setBounds(10, 30, getWidth(), 20);
+
+        recordButton.setBounds(10, 55, width - 10, 30);
     }
 
+   #if ENABLE_TRACE_CAPTURE
+    // Cmd/Ctrl+T writes the most recent trace events to a file in the documents folder
+    bool keyPressed(const KeyPress& key) override
+    {
+        if (key == KeyPress('t', ModifierKeys::commandModifier, 0))
+        {
+            const File traceFile = File::getSpecialLocation(File::userDocumentsDirectory)
+                                       .getNonexistentChildFile("ProcessingAudioInputTutorial-trace", ".json");
+
+            const String message = TraceCapture::getInstance().writeChromeJson(traceFile)
+                                       ? "Trace written to " + traceFile.getFullPathName()
+                                       : "Couldn't write trace to " + traceFile.getFullPathName();
+            {
+                TRACE_SCOPE("infoLabel update");
+                infoLabel.setText(message, dontSendNotification);
+            }
+            return true;
+        }
+
+        return false;
+    }
+   #endif
+
 private:
+    // The looper in the live graph, or nullptr if its configuration doesn't have one
+    SpillingLooperProcessor* findLooper() const
+    {
+        for (int i = 0; i < graph.getNumNodes(); i++)
+        {
+            if (auto* nodeLooper = dynamic_cast<SpillingLooperProcessor*>(graph.getNode(i)->getProcessor()))
+                return nodeLooper;
+        }
+
+        return nullptr;
+    }
+
+    // Starts a recording, or stops the one in progress
+    void toggleRecording()
+    {
+        TRACE_SCOPE("toggleRecording");
+
+        if (looper == nullptr)
+            return;
+
+        if (looper->isRecording())
+            looper->stopRecording();
+        else
+            looper->startRecording();
+    }
+
+    void timerCallback() override
+    {
+        TRACE_SCOPE("timerCallback");
+
+        recordButton.setEnabled(looper != nullptr);
+        recordButton.setButtonText(looper != nullptr && looper->isRecording() ? "Stop" : "Record");
+    }
+
     Random random;
     Slider levelSlider;
     Label levelLabel;
     Label infoLabel;
+    TextButton recordButton;
 
-    AudioProcessorGraph graph;
-    AudioProcessorPlayer player;
+    BudgetedProcessorGraph graph;
+    TracedAudioProcessorPlayer player;
+    SpillingLooperProcessor* looper = nullptr;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)
 };
@@ -0,0 +1,912 @@
+/*
+  ==============================================================================
+
+    SpillingLooper.h
+
+    A looper node whose RAM use is fixed when it's created, however long the
+    loop is and however many layers are recorded on top of it.
+
+    Loop audio is held in fixed-size chunks. A fixed pool of chunk slots is
+    allocated up front; every layer is spilled to its own raw float file on
+    disk by a background thread as soon as each chunk is recorded, and the
+    background thread prefetches the chunks just ahead of the playback
+    position back into the pool before they're needed. The audio thread only
+    ever touches the pool: it never waits on the disk, takes a lock or
+    allocates.
+
+    Each playing layer needs a window of resident chunks, so to keep the
+    pool big enough the background thread mixes the two oldest layers down
+    into one whenever more layers are playing than the pool can hold windows
+    for. Mixdowns are done a few chunks at a time from disk to disk, and the
+    mixed layer replaces its sources in a single atomic step once its own
+    window is resident.
+
+    The first recording sets the loop length; later recordings are overdubs
+    which always cover exactly one pass of the loop, starting wherever the
+    playback position is.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class SpillingLooperProcessor   : public AudioProcessor
+{
+public:
+    // spillDirectory is created if needed, and the layer files in it are deleted again
+    // when the looper is destroyed, along with the directory if the looper created it.
+    // maxCacheBytes caps the RAM used for loop audio; if it can't hold enough chunks of
+    // samplesPerChunk for this many channels, smaller chunks are used instead.
+    SpillingLooperProcessor(int numChannelsToLoop, const File& spillDirectory,
+                            size_t maxCacheBytes = 64 * 1024 * 1024, int samplesPerChunk = 65536)
+        : AudioProcessor(BusesProperties()
+                            .withInput("Input", AudioChannelSet::discreteChannels(numChannelsToLoop), true)
+                            .withOutput("Output", AudioChannelSet::discreteChannels(numChannelsToLoop), true)),
+          numChannels(numChannelsToLoop),
+          chunkSamples(getChunkSamples(numChannelsToLoop, maxCacheBytes, samplesPerChunk)),
+          directory(spillDirectory),
+          createdDirectory(! spillDirectory.exists()),
+          spillThread(*this)
+    {
+        directory.createDirectory();
+
+        // two chunks of scratch space for mixdowns come out of the same budget
+        const int numSlots = jmax(getMinNumChunks(), (int) (maxCacheBytes / getChunkBytes(numChannels, chunkSamples))) - 2;
+
+        // every live layer needs its window, plus one for a mixdown in progress and one
+        // for an overdub in progress, plus the slots the audio thread is recording into
+        maxPlayingLayers = jmin(maxLayers - 4, (numSlots - numRecordSlots) / (prefetchChunks + 1) - 2);
+        jassert(maxPlayingLayers >= minPlayingLayers);
+
+        for (int i = 0; i < numSlots; ++i)
+            slots.add(new ChunkSlot(numChannels, chunkSamples));
+
+        mixdownScratch.setSize(2 * numChannels, chunkSamples);
+
+        spillThread.startThread(6);
+    }
+
+    ~SpillingLooperProcessor()
+    {
+        spillThread.stopThread(5000);
+
+        for (auto& layer : layers)
+        {
+            layer.output = nullptr;
+
+            if (layer.file != File())
+                layer.file.deleteFile();
+        }
+
+        if (createdDirectory)
+            directory.deleteFile();
+    }
+
+    //==============================================================================
+    // Start recording: the first layer if the loop is empty, otherwise an overdub.
+    // Ignored while a previous overdub is still finishing its pass.
+    void startRecording()       { pendingCommand = recordCommand; }
+
+    // Stop recording. Stopping the first layer sets the loop length and starts playback
+    // from the top; stopping an overdub punches out, and the rest of its pass is silent.
+    void stopRecording()        { pendingCommand = stopCommand; }
+
+    bool isRecording() const                { return recordingLayerIndex.load() >= 0; }
+    int64 getLoopLengthSamples() const      { return loopLength.load(); }
+    int getNumPlayingLayers() const         { return countBits(playingLayers.load()); }
+    int getMaxPlayingLayers() const         { return maxPlayingLayers; }
+
+    // The RAM used for loop audio, which never changes after construction
+    size_t getCacheSizeBytes() const
+    {
+        return sizeof(float) * (size_t) numChannels * (size_t) chunkSamples * (size_t) (slots.size() + 2);
+    }
+
+    // The number of times a playing chunk wasn't resident in time and was played as silence
+    int getNumUnderruns() const             { return underruns.load(); }
+
+    // The number of chunks that couldn't be recorded because no free slot was ready
+    int getNumRecordDropouts() const        { return recordDropouts.load(); }
+
+    //==============================================================================
+    const String getName() const override   { return "Spilling Looper"; }
+
+    void prepareToPlay(double, int) override {}
+    void releaseResources() override {}
+
+    void processBlock(AudioBuffer<float>& buffer, MidiBuffer&) override
+    {
+        TRACE_SCOPE("Spilling looper");
+
+        handlePendingCommand();
+
+        const int numSamples = buffer.getNumSamples();
+        uint64 playing = playingLayers.load();
+        const int64 length = loopLength.load();
+        int position = 0;
+
+        while (position < numSamples)
+        {
+            const int64 chunk = playPosition / chunkSamples;
+            const int offset = (int) (playPosition % chunkSamples);
+            int64 numThisTime = jmin((int64) (numSamples - position), (int64) (chunkSamples - offset));
+
+            if (length > 0)
+                numThisTime = jmin(numThisTime, length - playPosition);
+
+            if (recordingLayer >= 0)
+                numThisTime = jmin(numThisTime, recordRemaining);
+
+            const int num = (int) numThisTime;
+
+            // the buffer is processed in place, so record the input before mixing the loop into it
+            if (recordingLayer >= 0)
+                record(buffer, position, offset, num);
+
+            for (int layer = 0; layer < maxLayers; ++layer)
+                if ((playing & ((uint64) 1 << layer)) != 0)
+                    play(buffer, position, layer, chunk, offset, num);
+
+            position += num;
+            playPosition += num;
+
+            if (recordingLayer >= 0)
+                recordRemaining -= num;
+
+            if (length > 0 && playPosition == length)
+                playPosition = 0;
+
+            if (recordingLayer >= 0)
+            {
+                if (recordRemaining == 0)
+                {
+                    // the new layer plays from the punch-in point, which may be in this block
+                    playing |= (uint64) 1 << recordingLayer;
+                    closeRecording();
+                }
+                else if (playPosition % chunkSamples == 0)
+                    moveToRecordChunk(playPosition / chunkSamples);
+            }
+        }
+
+        publishedPlayPosition = playPosition;
+        ++audioBlocks;
+    }
+
+    double getTailLengthSeconds() const override    { return 0.0; }
+    bool acceptsMidi() const override               { return false; }
+    bool producesMidi() const override              { return false; }
+
+    AudioProcessorEditor* createEditor() override   { return nullptr; }
+    bool hasEditor() const override                 { return false; }
+
+    int getNumPrograms() override                       { return 1; }
+    int getCurrentProgram() override                    { return 0; }
+    void setCurrentProgram(int) override                {}
+    const String getProgramName(int) override           { return {}; }
+    void changeProgramName(int, const String&) override {}
+
+    void getStateInformation(MemoryBlock&) override     {}
+    void setStateInformation(const void*, int) override {}
+
+private:
+    //==============================================================================
+    // A chunk's worth of audio for one layer. The state says which thread owns it:
+    // the audio thread owns reserved and recording slots, the spill thread owns free,
+    // loading and evicting ones, and resident and recorded slots can be read by the
+    // audio thread while it holds a pin on them.
+    struct ChunkSlot
+    {
+        enum State { free, reserved, recording, recorded, loading, resident, evicting };
+
+        ChunkSlot(int numChannels, int numSamples)
+            : audio(numChannels, numSamples)
+        {
+            audio.clear();
+        }
+
+        AudioBuffer<float> audio;
+        std::atomic<int> state { free };
+        std::atomic<int> pins { 0 };
+        std::atomic<int> layer { -1 };
+        std::atomic<int64> chunk { -1 };
+    };
+
+    //==============================================================================
+    struct Layer
+    {
+        // the audio thread moves a layer from reserved to recording to closed;
+        // every other transition is made by the spill thread
+        enum State { unused, reserved, recording, closed, mixing, retiring };
+
+        std::atomic<int> state { unused };
+
+        // only used by the spill thread
+        File file;
+        std::unique_ptr<FileOutputStream> output;
+        BigInteger writtenChunks;
+        int64 sequence = 0;
+        int64 retireAfterBlock = 0;
+    };
+
+    enum Command { noCommand, recordCommand, stopCommand };
+
+    static constexpr int maxLayers = 64;
+    static constexpr int prefetchChunks = 3;
+    static constexpr int numRecordSlots = 4;
+
+    // a mixdown needs two playing layers to mix
+    static constexpr int minPlayingLayers = 2;
+
+    const int numChannels;
+    const int chunkSamples;
+    const File directory;
+    const bool createdDirectory;
+    int maxPlayingLayers = 2;
+
+    OwnedArray<ChunkSlot> slots;
+    Layer layers[maxLayers];
+
+    // bit n is set while layer n is being played
+    std::atomic<uint64> playingLayers { 0 };
+
+    // slots the spill thread has cleared and handed over for recording
+    AbstractFifo recordSlotFifo { numRecordSlots };
+    int recordSlotQueue[numRecordSlots];
+
+    // a layer the spill thread has reserved for the next recording, or -1
+    std::atomic<int> nextRecordLayer { -1 };
+
+    std::atomic<int> pendingCommand { noCommand };
+    std::atomic<int> recordingLayerIndex { -1 };
+    std::atomic<int64> loopLength { 0 };
+    std::atomic<int64> publishedPlayPosition { 0 };
+    std::atomic<int64> audioBlocks { 0 };
+    std::atomic<int> underruns { 0 };
+    std::atomic<int> recordDropouts { 0 };
+
+    // only used on the audio thread
+    int64 playPosition = 0;
+    int recordingLayer = -1;
+    int64 recordRemaining = 0;
+    bool punchedOut = false;
+    int recordSlot = -1;
+    int headSlot = -1;
+    int64 headChunk = -1;
+    int lastPlayedSlot[maxLayers] = {};
+
+    // only used on the spill thread
+    AudioBuffer<float> mixdownScratch;
+    int64 nextSequence = 1;
+    int mixdownTarget = -1;
+    int mixdownSources[2] = { -1, -1 };
+    int64 mixdownNextChunk = 0;
+
+    static int countBits(uint64 bits)
+    {
+        int count = 0;
+
+        for (; bits != 0; bits &= bits - 1)
+            ++count;
+
+        return count;
+    }
+
+    int64 getNumChunks(int64 length) const  { return (length + chunkSamples - 1) / chunkSamples; }
+
+    // The chunks the cache must hold for minPlayingLayers, counted the same way as in the constructor
+    static int getMinNumChunks()
+    {
+        return (minPlayingLayers + 2) * (prefetchChunks + 1) + numRecordSlots + 2;
+    }
+
+    static size_t getChunkBytes(int numChannels, int chunkSamples)
+    {
+        return sizeof(float) * (size_t) jmax(1, numChannels) * (size_t) chunkSamples;
+    }
+
+    // The requested chunk size, or the largest that still fits the minimum number of chunks
+    // in the cache. Only a cache too small for that many single-sample chunks is overrun.
+    static int getChunkSamples(int numChannels, size_t maxCacheBytes, int samplesPerChunk)
+    {
+        const size_t fittingSamples = maxCacheBytes / ((size_t) getMinNumChunks() * getChunkBytes(numChannels, 1));
+        return (int) jlimit((size_t) 1, (size_t) jmax(1, samplesPerChunk), fittingSamples);
+    }
+
+    //==============================================================================
+    // Audio thread
+
+    void handlePendingCommand()
+    {
+        const int command = pendingCommand.exchange(noCommand);
+
+        if (command == recordCommand && recordingLayer < 0)
+        {
+            const int layer = nextRecordLayer.exchange(-1);
+
+            if (layer < 0)
+                return;
+
+            layers[layer].state = Layer::recording;
+            recordingLayer = layer;
+            recordingLayerIndex = layer;
+            punchedOut = false;
+
+            const int64 length = loopLength.load();
+
+            if (length == 0)
+            {
+                // the first layer starts the loop, and runs until it's stopped
+                playPosition = 0;
+                recordRemaining = std::numeric_limits<int64>::max();
+            }
+            else
+            {
+                recordRemaining = length;
+            }
+
+            // an overdub that starts part way through a chunk finishes part way through
+            // the same chunk, so that chunk's slot is kept until the pass is complete
+            headChunk = playPosition / chunkSamples;
+            headSlot = -1;
+            moveToRecordChunk(headChunk);
+
+            if (playPosition % chunkSamples != 0)
+                headSlot = recordSlot;
+        }
+        else if (command == stopCommand && recordingLayer >= 0)
+        {
+            if (loopLength.load() == 0)
+            {
+                if (playPosition == 0)
+                    return;
+
+                loopLength = playPosition;
+                closeRecording();
+                playPosition = 0;
+            }
+            else
+            {
+                punchedOut = true;
+            }
+        }
+    }
+
+    void moveToRecordChunk(int64 chunk)
+    {
+        if (recordSlot >= 0 && recordSlot != headSlot)
+            slots.getUnchecked(recordSlot)->state = ChunkSlot::recorded;
+
+        if (headSlot >= 0 && chunk == headChunk)
+        {
+            recordSlot = headSlot;
+            return;
+        }
+
+        recordSlot = -1;
+
+        int start1, size1, start2, size2;
+        recordSlotFifo.prepareToRead(1, start1, size1, start2, size2);
+
+        if (size1 == 0)
+        {
+            ++recordDropouts;
+            return;
+        }
+
+        recordSlot = recordSlotQueue[start1];
+        recordSlotFifo.finishedRead(1);
+
+        auto* slot = slots.getUnchecked(recordSlot);
+        slot->layer = recordingLayer;
+        slot->chunk = chunk;
+        slot->state = ChunkSlot::recording;
+    }
+
+    void record(const AudioBuffer<float>& buffer, int position, int offset, int numSamples)
+    {
+        if (recordSlot < 0 || punchedOut)
+            return;
+
+        auto* slot = slots.getUnchecked(recordSlot);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            slot->audio.copyFrom(channel, offset, buffer, channel, position, numSamples);
+    }
+
+    void closeRecording()
+    {
+        if (recordSlot >= 0 && recordSlot != headSlot)
+            slots.getUnchecked(recordSlot)->state = ChunkSlot::recorded;
+
+        if (headSlot >= 0)
+            slots.getUnchecked(headSlot)->state = ChunkSlot::recorded;
+
+        layers[recordingLayer].state = Layer::closed;
+        playingLayers.fetch_or((uint64) 1 << recordingLayer);
+
+        recordingLayer = -1;
+        recordingLayerIndex = -1;
+        recordSlot = -1;
+        headSlot = -1;
+    }
+
+    void play(AudioBuffer<float>& buffer, int position, int layer, int64 chunk, int offset, int numSamples)
+    {
+        auto* slot = pinSlot(layer, chunk);
+
+        if (slot == nullptr)
+        {
+            ++underruns;
+            return;
+        }
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            buffer.addFrom(channel, position, slot->audio, channel, offset, numSamples);
+
+        --slot->pins;
+    }
+
+    // Finds the slot holding this chunk and pins it so the spill thread can't evict it;
+    // the caller must decrement the slot's pins when it's done
+    ChunkSlot* pinSlot(int layer, int64 chunk)
+    {
+        if (auto* slot = tryPin(lastPlayedSlot[layer], layer, chunk))
+            return slot;
+
+        for (int i = 0; i < slots.size(); ++i)
+        {
+            if (auto* slot = tryPin(i, layer, chunk))
+            {
+                lastPlayedSlot[layer] = i;
+                return slot;
+            }
+        }
+
+        return nullptr;
+    }
+
+    ChunkSlot* tryPin(int index, int layer, int64 chunk)
+    {
+        auto* slot = slots.getUnchecked(index);
+
+        if (slot->layer.load() != layer || slot->chunk.load() != chunk)
+            return nullptr;
+
+        ++slot->pins;
+
+        const int state = slot->state.load();
+
+        if ((state == ChunkSlot::resident || state == ChunkSlot::recorded)
+             && slot->layer.load() == layer && slot->chunk.load() == chunk)
+            return slot;
+
+        --slot->pins;
+        return nullptr;
+    }
+
+    //==============================================================================
+    // Spill thread
+
+    class SpillThread   : public Thread
+    {
+    public:
+        SpillThread(SpillingLooperProcessor& looperToServe)
+            : Thread("Looper spill"), looper(looperToServe)
+        {
+        }
+
+        void run() override
+        {
+            while (! threadShouldExit())
+            {
+                looper.serviceSpill();
+                wait(5);
+            }
+        }
+
+    private:
+        SpillingLooperProcessor& looper;
+    };
+
+    SpillThread spillThread;
+
+    void serviceSpill()
+    {
+        TRACE_SCOPE("Looper spill");
+
+        writeRecordedSlots();
+        retireLayers();
+        refillRecordSlots();
+        reserveRecordLayer();
+        prefetch();
+        continueMixdown();
+    }
+
+    void writeRecordedSlots()
+    {
+        for (auto* slot : slots)
+        {
+            if (slot->state.load() != ChunkSlot::recorded)
+                continue;
+
+            Layer& layer = layers[slot->layer.load()];
+            writeChunk(layer, slot->chunk.load(), slot->audio);
+
+            // the audio thread may still be playing from it; it stays cached as a clean copy
+            slot->state = ChunkSlot::resident;
+        }
+
+        // close the file of any layer that has been completely written
+        for (int i = 0; i < maxLayers; ++i)
+            if (layers[i].output != nullptr && layers[i].state.load() == Layer::closed && ! hasUnwrittenSlots(i))
+                layers[i].output = nullptr;
+    }
+
+    bool hasUnwrittenSlots(int layer) const
+    {
+        for (auto* slot : slots)
+        {
+            const int state = slot->state.load();
+
+            if ((state == ChunkSlot::recording || state == ChunkSlot::recorded) && slot->layer.load() == layer)
+                return true;
+        }
+
+        return false;
+    }
+
+    void writeChunk(Layer& layer, int64 chunk, const AudioBuffer<float>& audio)
+    {
+        if (layer.output == nullptr)
+            return;
+
+        const int64 chunkBytes = (int64) sizeof(float) * chunkSamples;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            layer.output->setPosition((chunk * numChannels + channel) * chunkBytes);
+            layer.output->write(audio.getReadPointer(channel), (size_t) chunkBytes);
+        }
+
+        layer.output->flush();
+        layer.writtenChunks.setBit((int) chunk);
+    }
+
+    // Chunks beyond the end of the file, or that were never written, read as silence
+    void readChunk(const Layer& layer, int64 chunk, AudioBuffer<float>& audio, int firstChannel)
+    {
+        FileInputStream input(layer.file);
+        const int chunkBytes = (int) sizeof(float) * chunkSamples;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            float* dest = audio.getWritePointer(firstChannel + channel);
+            int bytesRead = 0;
+
+            if (input.openedOk() && input.setPosition((chunk * numChannels + channel) * chunkBytes))
+                bytesRead = jmax(0, input.read(dest, chunkBytes));
+
+            const int samplesRead = bytesRead / (int) sizeof(float);
+            FloatVectorOperations::clear(dest + samplesRead, chunkSamples - samplesRead);
+        }
+    }
+
+    void retireLayers()
+    {
+        const int64 blocks = audioBlocks.load();
+
+        for (int i = 0; i < maxLayers; ++i)
+        {
+            Layer& layer = layers[i];
+
+            // wait until the audio thread has finished any block that saw the layer playing
+            if (layer.state.load() != Layer::retiring || blocks < layer.retireAfterBlock)
+                continue;
+
+            bool allEvicted = true;
+
+            for (auto* slot : slots)
+            {
+                if (slot->layer.load() != i || slot->state.load() != ChunkSlot::resident)
+                    continue;
+
+                if (tryEvict(*slot))
+                    slot->state = ChunkSlot::free;
+                else
+                    allEvicted = false;
+            }
+
+            if (! allEvicted)
+                continue;
+
+            layer.output = nullptr;
+            layer.file.deleteFile();
+            layer.file = File();
+            layer.writtenChunks.clear();
+            layer.state = Layer::unused;
+        }
+    }
+
+    void refillRecordSlots()
+    {
+        while (recordSlotFifo.getFreeSpace() > 0)
+        {
+            const int index = acquireSlot();
+
+            if (index < 0)
+                return;
+
+            auto* slot = slots.getUnchecked(index);
+            slot->audio.clear();
+            slot->state = ChunkSlot::reserved;
+
+            int start1, size1, start2, size2;
+            recordSlotFifo.prepareToWrite(1, start1, size1, start2, size2);
+            recordSlotQueue[start1] = index;
+            recordSlotFifo.finishedWrite(1);
+        }
+    }
+
+    void reserveRecordLayer()
+    {
+        if (nextRecordLayer.load() >= 0)
+            return;
+
+        const int index = createLayer();
+
+        if (index >= 0)
+            nextRecordLayer = index;
+    }
+
+    // Returns a new reserved layer with an empty file, or -1 if none are free
+    int createLayer()
+    {
+        for (int i = 0; i < maxLayers; ++i)
+        {
+            Layer& layer = layers[i];
+
+            if (layer.state.load() != Layer::unused)
+                continue;
+
+            layer.sequence = nextSequence++;
+            layer.file = directory.getChildFile("layer-" + String(layer.sequence) + ".raw");
+            layer.file.deleteFile();
+            layer.output.reset(layer.file.createOutputStream());
+            layer.writtenChunks.clear();
+            layer.state = Layer::reserved;
+
+            return i;
+        }
+
+        return -1;
+    }
+
+    // True if the chunk is within the prefetch window of a layer that's playing or about to play
+    bool isWanted(int layer, int64 chunk) const
+    {
+        const Layer& info = layers[layer];
+        const int state = info.state.load();
+
+        // a layer that's been mixed down may still be played by the block in progress
+        const bool mayPlay = state == Layer::recording || state == Layer::closed
+                              || (state == Layer::mixing && mixdownComplete())
+                              || (state == Layer::retiring && audioBlocks.load() < info.retireAfterBlock);
+
+        if (! mayPlay)
+            return false;
+
+        const int64 length = loopLength.load();
+
+        // while the first layer is recording, playback will start from the top as soon as it stops
+        if (length == 0)
+            return chunk < prefetchChunks;
+
+        const int64 numChunks = getNumChunks(length);
+        const int64 current = publishedPlayPosition.load() / chunkSamples;
+
+        return (chunk - current + numChunks) % numChunks <= prefetchChunks;
+    }
+
+    bool isResidentOrPending(int layer, int64 chunk) const
+    {
+        for (auto* slot : slots)
+        {
+            if (slot->layer.load() == layer && slot->chunk.load() == chunk)
+            {
+                const int state = slot->state.load();
+
+                if (state != ChunkSlot::free && state != ChunkSlot::evicting)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    void prefetch()
+    {
+        const int64 length = loopLength.load();
+        const int64 numChunks = length > 0 ? getNumChunks(length) : prefetchChunks;
+        const int64 current = length > 0 ? publishedPlayPosition.load() / chunkSamples : 0;
+
+        for (int64 ahead = 0; ahead <= jmin((int64) prefetchChunks, numChunks - 1); ++ahead)
+        {
+            const int64 chunk = (current + ahead) % numChunks;
+
+            for (int i = 0; i < maxLayers; ++i)
+            {
+                if (! isWanted(i, chunk) || ! layers[i].writtenChunks[(int) chunk] || isResidentOrPending(i, chunk))
+                    continue;
+
+                const int index = acquireSlot();
+
+                if (index < 0)
+                    return;
+
+                auto* slot = slots.getUnchecked(index);
+                slot->state = ChunkSlot::loading;
+                slot->layer = i;
+                slot->chunk = chunk;
+                readChunk(layers[i], chunk, slot->audio, 0);
+                slot->state = ChunkSlot::resident;
+            }
+        }
+    }
+
+    // Returns a slot owned by the spill thread, evicting a chunk nobody needs if there's no
+    // free slot, or -1 if every slot is in use
+    int acquireSlot()
+    {
+        for (int i = 0; i < slots.size(); ++i)
+        {
+            int expected = ChunkSlot::free;
+
+            if (slots.getUnchecked(i)->state.compare_exchange_strong(expected, ChunkSlot::evicting))
+                return i;
+        }
+
+        for (int i = 0; i < slots.size(); ++i)
+        {
+            auto* slot = slots.getUnchecked(i);
+
+            if (slot->state.load() == ChunkSlot::resident
+                 && ! isWanted(slot->layer.load(), slot->chunk.load())
+                 && tryEvict(*slot))
+                return i;
+        }
+
+        return -1;
+    }
+
+    // Takes a resident slot back from the audio thread, unless it's currently pinned.
+    // On success the slot is left in the evicting state, owned by the spill thread.
+    bool tryEvict(ChunkSlot& slot)
+    {
+        int expected = ChunkSlot::resident;
+
+        if (! slot.state.compare_exchange_strong(expected, ChunkSlot::evicting))
+            return false;
+
+        if (slot.pins.load() != 0)
+        {
+            slot.state = ChunkSlot::resident;
+            return false;
+        }
+
+        slot.layer = -1;
+        slot.chunk = -1;
+        return true;
+    }
+
+    bool mixdownComplete() const
+    {
+        return mixdownTarget >= 0 && mixdownNextChunk >= getNumChunks(loopLength.load());
+    }
+
+    bool isFullyWritten(int layer) const
+    {
+        return layers[layer].state.load() == Layer::closed && layers[layer].output == nullptr;
+    }
+
+    void continueMixdown()
+    {
+        if (mixdownTarget < 0)
+        {
+            startMixdown();
+            return;
+        }
+
+        const int64 numChunks = getNumChunks(loopLength.load());
+        Layer& target = layers[mixdownTarget];
+
+        // a few chunks at a time, so recording and prefetching are never held up for long
+        for (int i = 0; i < 4 && mixdownNextChunk < numChunks; ++i, ++mixdownNextChunk)
+        {
+            readChunk(layers[mixdownSources[0]], mixdownNextChunk, mixdownScratch, 0);
+            readChunk(layers[mixdownSources[1]], mixdownNextChunk, mixdownScratch, numChannels);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                mixdownScratch.addFrom(channel, 0, mixdownScratch, numChannels + channel, 0, chunkSamples);
+
+            writeChunk(target, mixdownNextChunk, mixdownScratch);
+        }
+
+        if (mixdownNextChunk < numChunks)
+            return;
+
+        // only swap once the mixed layer's window is resident, so nothing is missed
+        const int64 current = publishedPlayPosition.load() / chunkSamples;
+
+        for (int64 ahead = 0; ahead <= jmin((int64) prefetchChunks, numChunks - 1); ++ahead)
+            if (! isResidentOrPending(mixdownTarget, (current + ahead) % numChunks))
+                return;
+
+        const uint64 sources = ((uint64) 1 << mixdownSources[0]) | ((uint64) 1 << mixdownSources[1]);
+        uint64 expected = playingLayers.load();
+
+        while (! playingLayers.compare_exchange_weak(expected, (expected & ~sources) | ((uint64) 1 << mixdownTarget)))
+        {
+        }
+
+        target.output = nullptr;
+        target.state = Layer::closed;
+
+        const int64 retireAfter = audioBlocks.load() + 2;
+
+        for (int source : mixdownSources)
+        {
+            layers[source].retireAfterBlock = retireAfter;
+            layers[source].state = Layer::retiring;
+        }
+
+        mixdownTarget = -1;
+    }
+
+    void startMixdown()
+    {
+        const uint64 playing = playingLayers.load();
+
+        if (countBits(playing) <= maxPlayingLayers)
+            return;
+
+        // mix the two oldest layers, as long as they're both safely on disk
+        int oldest = -1, secondOldest = -1;
+
+        for (int i = 0; i < maxLayers; ++i)
+        {
+            if ((playing & ((uint64) 1 << i)) == 0)
+                continue;
+
+            if (oldest < 0 || layers[i].sequence < layers[oldest].sequence)
+            {
+                secondOldest = oldest;
+                oldest = i;
+            }
+            else if (secondOldest < 0 || layers[i].sequence < layers[secondOldest].sequence)
+            {
+                secondOldest = i;
+            }
+        }
+
+        if (secondOldest < 0 || ! isFullyWritten(oldest) || ! isFullyWritten(secondOldest))
+            return;
+
+        const int target = createLayer();
+
+        if (target < 0)
+            return;
+
+        // the mixed layer takes the place of the oldest one
+        layers[target].sequence = layers[oldest].sequence;
+        layers[target].state = Layer::mixing;
+
+        mixdownSources[0] = oldest;
+        mixdownSources[1] = secondOldest;
+        mixdownNextChunk = 0;
+        mixdownTarget = target;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpillingLooperProcessor)
+};
@@ -0,0 +1,240 @@
+/*
+  ==============================================================================
+
+    SpillingLooperTest.h
+
+    Soak test for SpillingLooperProcessor. A looper with a small cache is fed
+    hours of audio: it records a first layer, then overdubs pass after pass
+    on top of it for the rest of the run, so many more layers are recorded
+    than the cache can play at once and the spill thread has to keep mixing
+    them down.
+
+    Every layer records the same signal, which depends only on the loop
+    position and is chosen so that any number of layers sum exactly. The
+    expected output of every sample is therefore known, and any missing or
+    misplaced audio shows up as a mismatch.
+
+    On Linux the process's resident memory is sampled throughout the run,
+    and the test fails if it grew by more than the cache size plus a little
+    slack for file buffers; hours of audio held in RAM would be gigabytes.
+
+    Usage:
+
+        ProcessingAudioInputTutorial --looper-test [options]
+
+    options:
+        --hours <n>         length of audio to feed through the looper (default 2)
+        --speed <n>         how many times faster than realtime to run (default 32)
+        --loop-seconds <n>  length of the loop (default 20)
+        --cache-mb <n>      the looper's cache size in megabytes (default 16)
+        --block-size <n>    samples per processBlock call (default 64)
+
+    The spill thread works in wall-clock time, so the blocks are paced to run
+    at the given speed rather than as fast as possible.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class SpillingLooperTest   : public CommandLineHarness
+{
+public:
+    static StringArray getArguments()   { return { "--looper-test" }; }
+
+    // Run the test and return the process exit code
+    static int run(const StringArray& args)
+    {
+        SpillingLooperTest test;
+        test.hours = jmax(0.001, getArgumentValue(args, "--hours", "2").getDoubleValue());
+        test.speed = jmax(1.0, getArgumentValue(args, "--speed", "32").getDoubleValue());
+        test.loopSeconds = jmax(1.0, getArgumentValue(args, "--loop-seconds", "20").getDoubleValue());
+        test.cacheBytes = (size_t) jmax(1, getArgumentValue(args, "--cache-mb", "16").getIntValue()) * 1024 * 1024;
+        test.blockSize = jmax(1, getArgumentValue(args, "--block-size", "64").getIntValue());
+
+        const File directory = File::getSpecialLocation(File::tempDirectory)
+                                   .getNonexistentChildFile("spilling-looper-test", {}, false);
+        const int result = test.runTest(directory);
+        directory.deleteRecursively();
+
+        return result;
+    }
+
+private:
+    static constexpr int numChannels = 2;
+    static constexpr int chunkSamples = 32768;
+
+    // resident memory growth allowed beyond the cache, for file buffers and bookkeeping
+    static constexpr int64 memorySlackBytes = 16 * 1024 * 1024;
+
+    double sampleRate = 48000.0;
+    double hours = 2.0;
+    double speed = 32.0;
+    double loopSeconds = 20.0;
+    size_t cacheBytes = 16 * 1024 * 1024;
+    int blockSize = 64;
+
+    SpillingLooperTest()
+        : CommandLineHarness("looper-test")
+    {
+    }
+
+    // The test signal at a loop position: whole multiples of 2^-15, small enough
+    // that hundreds of layers of it add up without rounding
+    static float getLoopSample(int channel, int64 loopPosition)
+    {
+        return (float) ((loopPosition * 7919 + channel * 104729) % 255 - 127) / 32768.0f;
+    }
+
+    // The process's resident memory, or -1 where it can't be read
+    static int64 getResidentBytes()
+    {
+       #if JUCE_LINUX
+        const String residentKilobytes = File("/proc/self/status").loadFileAsString()
+                                             .fromFirstOccurrenceOf("VmRSS:", false, false)
+                                             .upToFirstOccurrenceOf("\n", false, false).trim();
+
+        if (residentKilobytes.isNotEmpty())
+            return residentKilobytes.getLargeIntValue() * 1024;
+       #endif
+
+        return -1;
+    }
+
+    int runTest(const File& directory)
+    {
+        const int64 startResidentBytes = getResidentBytes();
+        int64 peakResidentBytes = startResidentBytes;
+
+        SpillingLooperProcessor looper(numChannels, directory, cacheBytes, chunkSamples);
+        looper.setPlayConfigDetails(numChannels, numChannels, sampleRate, blockSize);
+        looper.prepareToPlay(sampleRate, blockSize);
+
+        // an odd length, so passes end part way through a block
+        const int64 loopLength = (int64) (loopSeconds * sampleRate) + blockSize / 2 + 1;
+        const int64 totalSamples = jmax(2 * loopLength, (int64) (hours * 3600.0 * sampleRate));
+
+        AudioBuffer<float> block(numChannels, blockSize);
+        MidiBuffer midi;
+
+        const double startMs = Time::getMillisecondCounterHiRes();
+        int64 rendered = 0;
+        int64 loopPosition = 0;
+        int64 mismatches = 0;
+        int maxPlaying = 0;
+
+        // the layers that have finished recording, and when the one being recorded finishes
+        int completedLayers = 0;
+        int64 overdubEndsAt = -1;
+
+        while (rendered < totalSamples)
+        {
+            // the spill thread runs in wall-clock time, so don't get further ahead of it than the speed allows
+            const double dueMs = startMs + 1000.0 * (double) rendered / (sampleRate * speed);
+
+            if (Time::getMillisecondCounterHiRes() < dueMs - 2.0)
+                Thread::sleep(1);
+
+            const bool firstLayer = completedLayers == 0;
+            int numSamples = blockSize;
+
+            if (firstLayer)
+            {
+                if (! looper.isRecording())
+                    looper.startRecording();
+                else if (loopPosition == loopLength)
+                    looper.stopRecording();
+                else
+                    numSamples = (int) jmin((int64) blockSize, loopLength - loopPosition);
+            }
+            else if (overdubEndsAt < 0)
+            {
+                looper.startRecording();
+            }
+
+            // the first layer stops at the start of the block, and playback starts from the top
+            if (firstLayer && loopPosition == loopLength)
+            {
+                completedLayers = 1;
+                loopPosition = 0;
+            }
+
+            AudioBuffer<float> buffer(block.getArrayOfWritePointers(), numChannels, numSamples);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                float* samples = buffer.getWritePointer(channel);
+
+                for (int i = 0; i < numSamples; ++i)
+                    samples[i] = getLoopSample(channel, (loopPosition + i) % loopLength);
+            }
+
+            midi.clear();
+            looper.processBlock(buffer, midi);
+
+            // a record command takes effect at the start of the block
+            if (! firstLayer && overdubEndsAt < 0 && looper.isRecording())
+                overdubEndsAt = rendered + loopLength;
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                if (rendered + i == overdubEndsAt)
+                {
+                    ++completedLayers;
+                    overdubEndsAt = -1;
+                }
+
+                const int64 position = (loopPosition + i) % loopLength;
+
+                for (int channel = 0; channel < numChannels; ++channel)
+                    if (buffer.getSample(channel, i) != (float) (completedLayers + 1) * getLoopSample(channel, position))
+                        ++mismatches;
+            }
+
+            // until the first layer is stopped, the position only moves while it's recording
+            if (completedLayers > 0)
+                loopPosition = (loopPosition + numSamples) % loopLength;
+            else if (looper.isRecording())
+                loopPosition += numSamples;
+
+            // once a second of audio, which is plenty for memory that would grow with the loop
+            if (rendered / (int64) sampleRate != (rendered + numSamples) / (int64) sampleRate && startResidentBytes >= 0)
+                peakResidentBytes = jmax(peakResidentBytes, getResidentBytes());
+
+            rendered += numSamples;
+            maxPlaying = jmax(maxPlaying, looper.getNumPlayingLayers());
+        }
+
+        const double elapsedSeconds = (Time::getMillisecondCounterHiRes() - startMs) / 1000.0;
+
+        log(String(rendered / sampleRate / 3600.0, 2) + " hours in "
+             + String(elapsedSeconds, 1) + " s, " + String(completedLayers) + " layers recorded"
+             + ", most playing " + String(maxPlaying) + " (max " + String(looper.getMaxPlayingLayers()) + ")"
+             + ", underruns " + String(looper.getNumUnderruns())
+             + ", record dropouts " + String(looper.getNumRecordDropouts())
+             + ", mismatched samples " + String(mismatches)
+             + ", cache " + String((int64) looper.getCacheSizeBytes()) + " bytes (cap " + String((int64) cacheBytes) + ")"
+             + (startResidentBytes >= 0 ? ", resident memory grew by " + String(peakResidentBytes - startResidentBytes) + " bytes"
+                                        : String(", resident memory not measured on this platform")));
+
+        if (looper.getNumUnderruns() != 0)
+            return fail("chunks weren't resident in time to play");
+
+        if (looper.getNumRecordDropouts() != 0)
+            return fail("chunks couldn't be recorded");
+
+        if (startResidentBytes >= 0 && peakResidentBytes - startResidentBytes > (int64) cacheBytes + memorySlackBytes)
+            return fail("resident memory grew by more than the cache and its slack");
+
+        if (mismatches != 0)
+            return fail("the output didn't match the recorded layers");
+
+        if (completedLayers <= looper.getMaxPlayingLayers())
+            return fail("too few layers were recorded to need a mixdown");
+
+        return pass();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpillingLooperTest)
+};
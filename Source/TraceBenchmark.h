@@ -0,0 +1,108 @@
+/*
+  ==============================================================================
+
+    TraceBenchmark.h
+
+    Measures what an empty TRACE_SCOPE costs on the calling thread: two
+    counter reads and one event written to the thread's ring buffer. Every
+    traced scope on the audio thread pays this, so it has to stay well
+    under the budget below.
+
+    Usage:
+
+        ProcessingAudioInputTutorial --trace-benchmark [options]
+
+    options:
+        --events <n>    number of events to time in each round (default 2000000)
+        --rounds <n>    number of rounds to take the fastest from (default 5)
+
+    The two counter reads usually dominate, and what they cost depends on
+    the CPU (and is higher under some virtual machines), so their share is
+    logged separately.
+    The run fails if an event costs more than the budget.
+    With ENABLE_TRACE_CAPTURE off the macros expand to nothing, so there is
+    nothing to time and the benchmark just says so.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class TraceBenchmark   : public CommandLineHarness
+{
+public:
+    static StringArray getArguments()   { return { "--trace-benchmark" }; }
+
+    // Run the benchmark and return the process exit code
+    static int run(const StringArray& args)
+    {
+        TraceBenchmark benchmark;
+
+       #if ENABLE_TRACE_CAPTURE
+        const int numEvents = jmax(1, getArgumentValue(args, "--events", "2000000").getIntValue());
+        const int numRounds = jmax(1, getArgumentValue(args, "--rounds", "5").getIntValue());
+
+        // claims this thread's buffer and warms the caches
+        timeEvents(1000);
+
+        // the fastest round is the one least disturbed by interrupts and other processes
+        double nanosecondsPerEvent = std::numeric_limits<double>::max();
+        double clockNanosecondsPerEvent = std::numeric_limits<double>::max();
+
+        for (int round = 0; round < numRounds; ++round)
+        {
+            nanosecondsPerEvent = jmin(nanosecondsPerEvent, timeEvents(numEvents));
+            clockNanosecondsPerEvent = jmin(clockNanosecondsPerEvent, timeCounterReads(numEvents));
+        }
+
+        benchmark.log(String(numRounds) + " rounds of " + String(numEvents) + " empty TRACE_SCOPEs, "
+                       + String(nanosecondsPerEvent, 1) + " ns per event (budget "
+                       + String(budgetNanosecondsPerEvent, 0) + " ns), of which "
+                       + String(clockNanosecondsPerEvent, 1) + " ns reading the counter");
+
+        if (nanosecondsPerEvent >= budgetNanosecondsPerEvent)
+            return benchmark.fail("an event costs more than the budget");
+
+        return benchmark.pass();
+       #else
+        ignoreUnused(args);
+        return benchmark.pass("tracing is off (ENABLE_TRACE_CAPTURE is 0), so TRACE_SCOPE costs nothing");
+       #endif
+    }
+
+private:
+    static constexpr double budgetNanosecondsPerEvent = 50.0;
+
+    TraceBenchmark()
+        : CommandLineHarness("trace-bench")
+    {
+    }
+
+   #if ENABLE_TRACE_CAPTURE
+    static double timeEvents(int numEvents)
+    {
+        const int64 startTicks = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numEvents; ++i)
+        {
+            TRACE_SCOPE("Trace benchmark");
+        }
+
+        return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks) * 1.0e9 / numEvents;
+    }
+
+    // The same number of counter reads as numEvents events make, on their own
+    static double timeCounterReads(int numEvents)
+    {
+        const int64 startTicks = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < 2 * numEvents; ++i)
+            TraceCapture::getCounter();
+
+        return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks) * 1.0e9 / numEvents;
+    }
+   #endif
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TraceBenchmark)
+};
@@ -0,0 +1,406 @@
+/*
+  ==============================================================================
+
+    TraceCapture.h
+
+    Low overhead tracing of audio thread and message thread events, written
+    out on demand in the Chrome trace event JSON format, which both
+    chrome://tracing and ui.perfetto.dev can open.
+
+    Mark a scope with TRACE_SCOPE ("name"); the name must outlive the
+    program, so use a string literal or a name returned by TRACE_INTERN.
+    Each thread records into its own preallocated ring buffer, with no
+    locks or allocation, so the most recent events on every thread are
+    always available when a dropout needs explaining. A thread hands its
+    buffer back when it exits, so the threads an audio driver creates
+    each time the device restarts don't use them up.
+
+    Events are timed with the CPU's own counter (the TSC on x86, the virtual
+    counter on ARM), which is much cheaper to read than the OS clock behind
+    Time::getHighResolutionTicks; the counter is converted to time when the
+    events are written out, by comparing how far it and the OS clock have
+    moved since startup. This relies on the counter running at a fixed rate
+    on every core, which it does on any x86 CPU with an invariant TSC and on
+    every ARMv8 CPU.
+
+    Tracing is switched on with ENABLE_TRACE_CAPTURE in AppConfig.h; when
+    it's off the macros expand to nothing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#ifndef ENABLE_TRACE_CAPTURE
+ #define ENABLE_TRACE_CAPTURE 0
+#endif
+
+#if ENABLE_TRACE_CAPTURE
+
+#if JUCE_INTEL
+ #if JUCE_MSVC
+  #include <intrin.h>
+ #else
+  #include <x86intrin.h>
+ #endif
+#endif
+
+//==============================================================================
+class TraceCapture
+{
+public:
+    // The event timestamp: the CPU's counter where there's a cheap one to read,
+    // otherwise the high resolution ticks
+    static inline int64 getCounter() noexcept
+    {
+       #if JUCE_INTEL
+        return (int64) __rdtsc();
+       #elif JUCE_ARM && JUCE_64BIT && ! JUCE_MSVC
+        int64 counter;
+        asm volatile ("mrs %0, cntvct_el0" : "=r" (counter));
+        return counter;
+       #else
+        return Time::getHighResolutionTicks();
+       #endif
+    }
+
+    // Call once from the message thread at startup, so the buffers aren't
+    // allocated by whichever thread happens to record the first event
+    static TraceCapture& getInstance()
+    {
+        static TraceCapture instance;
+        return instance;
+    }
+
+    // Returns a copy of the name that lives as long as the program does
+    const char* intern(const String& name)
+    {
+        const ScopedLock sl(internLock);
+
+        for (auto* internedName : internedNames)
+            if (*internedName == name)
+                return internedName->toRawUTF8();
+
+        return internedNames.add(new String(name))->toRawUTF8();
+    }
+
+    // Record a completed event on the calling thread
+    void record(const char* name, int64 startCounter, int64 endCounter) noexcept
+    {
+        static thread_local BufferClaim claim;
+
+        if (claim.buffer == nullptr)
+            claim.buffer = claimBuffer();
+
+        ThreadBuffer* const threadBuffer = claim.buffer;
+
+        if (threadBuffer == nullptr)
+        {
+            ++numDroppedEvents;
+            return;
+        }
+
+        const uint64 index = threadBuffer->writeCount.load(std::memory_order_relaxed);
+        EventSlot& slot = threadBuffer->events[index & (eventsPerThread - 1)];
+
+        // the slot's sequence is zero while it's being written, so a reader can tell a torn event
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.startCounter.store(startCounter, std::memory_order_relaxed);
+        slot.endCounter.store(endCounter, std::memory_order_relaxed);
+
+        slot.sequence.store(index + 1, std::memory_order_release);
+        threadBuffer->writeCount.store(index + 1, std::memory_order_release);
+    }
+
+    // Write the most recent events from every thread; call from the message thread
+    bool writeChromeJson(const File& file)
+    {
+        file.deleteFile();
+        std::unique_ptr<FileOutputStream> output(file.createOutputStream());
+
+        if (output == nullptr)
+            return false;
+
+        const double countsPerMicrosecond = getCountsPerSecond() / 1.0e6;
+        Array<Event> events;
+        bool isFirst = true;
+
+        *output << "{\"traceEvents\":[\n";
+
+        // a buffer whose thread has exited still holds that thread's last events
+        for (int tid = 0; tid < maxThreads; ++tid)
+        {
+            ThreadBuffer& buffer = buffers[tid];
+            const uint64 firstEvent = buffer.firstEvent.load(std::memory_order_acquire);
+
+            if (buffer.writeCount.load(std::memory_order_acquire) == 0 || firstEvent == claimingBuffer)
+                continue;
+
+            const String threadName = getThreadName(buffer, tid);
+            copyEvents(buffer, firstEvent, events);
+
+            // skip a buffer that was handed to a new thread while it was being read
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (buffer.firstEvent.load(std::memory_order_relaxed) != firstEvent)
+                continue;
+
+            writeSeparator(*output, isFirst);
+            *output << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                    << ",\"args\":{\"name\":" << JSON::toString(threadName) << "}}";
+
+            for (auto& event : events)
+            {
+                writeSeparator(*output, isFirst);
+                *output << "{\"name\":" << JSON::toString(String(event.name))
+                        << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                        << ",\"ts\":" << String((event.startCounter - originCounter) / countsPerMicrosecond, 3)
+                        << ",\"dur\":" << String((event.endCounter - event.startCounter) / countsPerMicrosecond, 3) << "}";
+            }
+        }
+
+        *output << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        output->flush();
+
+        return ! output->getStatus().failed();
+    }
+
+    // The number of events lost because more threads were recording at once than there are buffers
+    int getNumDroppedEvents() const     { return numDroppedEvents.load(); }
+
+    //==============================================================================
+    class ScopedEvent
+    {
+    public:
+        ScopedEvent(const char* eventName) noexcept
+            : name(eventName), startCounter(getCounter())
+        {
+        }
+
+        ~ScopedEvent() noexcept
+        {
+            TraceCapture::getInstance().record(name, startCounter, getCounter());
+        }
+
+    private:
+        const char* const name;
+        const int64 startCounter;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedEvent)
+    };
+
+private:
+    struct Event
+    {
+        const char* name;
+        int64 startCounter;
+        int64 endCounter;
+    };
+
+    // An event in a ring buffer. The fields are atomic because the message thread can
+    // read a slot while its thread is overwriting it; sequence is one more than the
+    // event's index in the thread's stream once the event is complete.
+    struct EventSlot
+    {
+        std::atomic<uint64> sequence { 0 };
+        std::atomic<const char*> name { nullptr };
+        std::atomic<int64> startCounter { 0 };
+        std::atomic<int64> endCounter { 0 };
+    };
+
+    // eventsPerThread must be a power of two
+    static constexpr int maxThreads = 16;
+    static constexpr uint64 eventsPerThread = 8192;
+
+    // firstEvent is set to this while a buffer is being handed to a new thread
+    static constexpr uint64 claimingBuffer = std::numeric_limits<uint64>::max();
+
+    struct ThreadBuffer
+    {
+        std::atomic<bool> claimed { false };
+        std::atomic<uint64> writeCount { 0 };
+
+        // the index of the first event recorded by the thread that has the buffer now;
+        // any earlier ones were recorded by a thread that has exited
+        std::atomic<uint64> firstEvent { 0 };
+
+        // atomic because the message thread can read them while a new thread claims the buffer
+        std::atomic<bool> isMessageThread { false };
+        std::atomic<char> threadName[64] = {};
+
+        EventSlot events[eventsPerThread];
+    };
+
+    // Holds the calling thread's buffer, and hands it back when the thread exits
+    struct BufferClaim
+    {
+        ~BufferClaim()
+        {
+            if (buffer != nullptr)
+                buffer->claimed.store(false, std::memory_order_release);
+        }
+
+        ThreadBuffer* buffer = nullptr;
+    };
+
+    std::unique_ptr<ThreadBuffer[]> buffers;
+
+    // the counter and the high resolution ticks at startup, to convert the counter to time
+    const int64 originCounter;
+    const int64 originTicks;
+    std::atomic<int> numDroppedEvents { 0 };
+
+    CriticalSection internLock;
+    OwnedArray<String> internedNames;
+
+    TraceCapture()
+        : buffers(new ThreadBuffer[maxThreads]),
+          originCounter(getCounter()),
+          originTicks(Time::getHighResolutionTicks())
+    {
+    }
+
+    // How fast the counter runs, measured against the high resolution ticks since startup
+    double getCountsPerSecond() const
+    {
+        // a short baseline would make the rate imprecise
+        while (Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - originTicks) < 0.1)
+            Thread::sleep(10);
+
+        const int64 counter = getCounter();
+        const int64 ticks = Time::getHighResolutionTicks();
+
+        return (counter - originCounter) / Time::highResolutionTicksToSeconds(ticks - originTicks);
+    }
+
+    // Called on each thread the first time it records an event, and again on each event
+    // for as long as every buffer is taken. Buffers that have never been used are handed
+    // out first, so the last events of threads that have exited are kept for longer.
+    ThreadBuffer* claimBuffer() noexcept
+    {
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int i = 0; i < maxThreads; ++i)
+            {
+                ThreadBuffer& buffer = buffers[i];
+                bool expected = false;
+
+                if (buffer.claimed.load(std::memory_order_relaxed)
+                     || (pass == 0 && buffer.writeCount.load(std::memory_order_relaxed) != 0))
+                    continue;
+
+                if (buffer.claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                {
+                    buffer.firstEvent.store(claimingBuffer, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+
+                    buffer.isMessageThread.store(MessageManager::existsAndIsCurrentThread(), std::memory_order_relaxed);
+
+                    char name[sizeof(buffer.threadName)] = {};
+
+                    if (auto* thread = Thread::getCurrentThread())
+                        thread->getThreadName().copyToUTF8(name, sizeof(name));
+
+                    for (size_t c = 0; c < sizeof(name); ++c)
+                        buffer.threadName[c].store(name[c], std::memory_order_relaxed);
+
+                    buffer.firstEvent.store(buffer.writeCount.load(std::memory_order_relaxed), std::memory_order_release);
+                    return &buffer;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    static String getThreadName(const ThreadBuffer& buffer, int tid)
+    {
+        if (buffer.isMessageThread.load(std::memory_order_relaxed))
+            return "Message thread";
+
+        char name[sizeof(buffer.threadName)];
+
+        for (size_t c = 0; c < sizeof(name); ++c)
+            name[c] = buffer.threadName[c].load(std::memory_order_relaxed);
+
+        name[sizeof(name) - 1] = 0;
+
+        if (name[0] != 0)
+            return String::fromUTF8(name);
+
+        // threads that JUCE didn't create are usually the audio driver's
+        return "Thread " + String(tid);
+    }
+
+    // Copies out the events from firstEvent on that are still in the ring, skipping any
+    // that were being written or overwritten while they were copied
+    static void copyEvents(const ThreadBuffer& buffer, uint64 firstEvent, Array<Event>& events)
+    {
+        events.clearQuick();
+
+        const uint64 end = buffer.writeCount.load(std::memory_order_acquire);
+        const uint64 start = jmax(firstEvent, end > eventsPerThread ? end - eventsPerThread : 0);
+
+        for (uint64 i = start; i < end; ++i)
+        {
+            const EventSlot& slot = buffer.events[i & (eventsPerThread - 1)];
+
+            if (slot.sequence.load(std::memory_order_acquire) != i + 1)
+                continue;
+
+            const Event event { slot.name.load(std::memory_order_relaxed),
+                                slot.startCounter.load(std::memory_order_relaxed),
+                                slot.endCounter.load(std::memory_order_relaxed) };
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slot.sequence.load(std::memory_order_relaxed) == i + 1)
+                events.add(event);
+        }
+    }
+
+    static void writeSeparator(OutputStream& output, bool& isFirst)
+    {
+        if (! isFirst)
+            output << ",\n";
+
+        isFirst = false;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (TraceCapture)
+};
+
+#define TRACE_SCOPE(name)   const TraceCapture::ScopedEvent JUCE_JOIN_MACRO (traceScope, __LINE__) (name);
+#define TRACE_INTERN(name)  TraceCapture::getInstance().intern(name)
+
+//==============================================================================
+// Traces every audio device callback
+class TracedAudioProcessorPlayer   : public AudioProcessorPlayer
+{
+public:
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                               float** outputChannelData, int numOutputChannels, int numSamples) override
+    {
+        TRACE_SCOPE("AudioProcessorPlayer callback");
+        AudioProcessorPlayer::audioDeviceIOCallback(inputChannelData, numInputChannels,
+                                                    outputChannelData, numOutputChannels, numSamples);
+    }
+
+    void audioDeviceAboutToStart(AudioIODevice* device) override
+    {
+        TRACE_SCOPE("AudioProcessorPlayer about to start");
+        AudioProcessorPlayer::audioDeviceAboutToStart(device);
+    }
+};
+
+#else
+
+typedef AudioProcessorPlayer TracedAudioProcessorPlayer;
+
+#define TRACE_SCOPE(name)
+#define TRACE_INTERN(name)  nullptr
+
+#endif